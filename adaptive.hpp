@@ -0,0 +1,255 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cbinsort.hpp"
+#include "cradixsort.hpp"
+#include "generate.hpp"
+#include "threadpool.hpp"
+
+// Sizes at which Sort() switches kernels, as found by Calibrate() on this machine for one type.
+struct SortThresholds {
+  unsigned long radix_min = 0x4000; // CountingRadixSort beats std::sort on random keys
+  unsigned long dup_radix_min = 0x10000; // The same, when most keys are duplicates
+  unsigned long parallel_min = 0x100000; // The threaded bin sort beats both
+  bool calibrated = false;
+
+  // Read the thresholds for the type from the file, of lines of "name value type".
+  bool Load(const char* path, const std::string& type) noexcept {
+    FILE* in = std::fopen(path, "r");
+    if (in == nullptr) {
+      return false;
+    }
+    char name[64];
+    unsigned long value;
+    char line_type[64];
+    while (std::fscanf(in, "%63s %lu %63[^\n]", name, &value, line_type) == 3) {
+      if (type != line_type) {
+        continue;
+      }
+      calibrated = true;
+      if (std::string(name) == "radix_min") {
+        radix_min = value;
+      } else if (std::string(name) == "dup_radix_min") {
+        dup_radix_min = value;
+      } else if (std::string(name) == "parallel_min") {
+        parallel_min = value;
+      }
+    }
+    std::fclose(in);
+    return calibrated;
+  }
+
+  // Write the thresholds for the type to the file, keeping those there for any other type.
+  bool Save(const char* path, const std::string& type) const noexcept {
+    std::vector<std::string> kept;
+    if (FILE* in = std::fopen(path, "r")) {
+      char line[256];
+      while (std::fgets(line, sizeof(line), in) != nullptr) {
+        std::string text(line);
+        auto place = text.find(' ', text.find(' ') + 1);
+        if (place != std::string::npos && text.substr(place + 1) != type + "\n") {
+          kept.push_back(text);
+        }
+      }
+      std::fclose(in);
+    }
+    FILE* out = std::fopen(path, "w");
+    if (out == nullptr) {
+      std::fprintf(stderr, "Can't write calibration file %s\n", path);
+      return false;
+    }
+    for (auto& text : kept) {
+      std::fputs(text.c_str(), out);
+    }
+    std::fprintf(out, "radix_min %lu %s\n", radix_min, type.c_str());
+    std::fprintf(out, "dup_radix_min %lu %s\n", dup_radix_min, type.c_str());
+    std::fprintf(out, "parallel_min %lu %s\n", parallel_min, type.c_str());
+    return std::fclose(out) == 0;
+  }
+};
+
+// What a cheap look at a sample of the input found.
+struct SortProfile {
+  unsigned long size;
+  double ascending; // Fraction of sampled neighbors in ascending order (or equal)
+  double descending; // Fraction of sampled neighbors in descending order (or equal)
+  double unique; // Fraction of the sampled keys that are distinct
+  unsigned key_bits; // Bits, from the bottom, that vary among the sampled keys
+};
+
+// Profile the input from up to 1024 neighbor pairs, spread evenly over it.
+template <typename T>
+SortProfile ProfileInput(const T& data) noexcept {
+  using E = typename T::value_type;
+  using Key = typename E::Key;
+  SortProfile profile = {data.size(), 1.0, 1.0, 1.0, 0};
+  if (data.size() < 2) {
+    return profile;
+  }
+
+  const unsigned long samples = std::min(1024UL, data.size() - 1);
+  std::vector<Key> keys(samples);
+  unsigned long rises = 0;
+  unsigned long falls = 0;
+  for (unsigned long sample = 0; sample < samples; ++sample) {
+    auto place = sample * (data.size() - 1) / samples;
+    rises += (data[place] < data[place + 1]);
+    falls += (data[place + 1] < data[place]);
+    E::GetKeys(&data[place], 1, &keys[sample]);
+  }
+  profile.ascending = 1.0 - static_cast<double>(falls) / samples;
+  profile.descending = 1.0 - static_cast<double>(rises) / samples;
+
+  Key varying = 0;
+  for (auto key : keys) {
+    varying |= key ^ keys.front();
+  }
+  for (; varying != 0; varying >>= 1) {
+    ++profile.key_bits;
+  }
+  std::sort(keys.begin(), keys.end());
+  profile.unique = static_cast<double>(std::unique(keys.begin(), keys.end()) - keys.begin())
+      / samples;
+  return profile;
+}
+
+// Which kernel Sort() ran, and why.
+struct SortChoice {
+  std::string kernel;
+  std::string reason;
+
+  std::string Describe() const {
+    return kernel + ": " + reason;
+  }
+};
+
+// Sort data with whichever kernel should be fastest for it, picked from a profile of a sample of
+// the input, and the thresholds calibrated for this machine.  Not Stable, Not In-Place.
+template <typename T>
+SortChoice Sort(
+    T& data,
+    int threads = ThreadPool::Get().Size(),
+    const SortThresholds& limits = SortThresholds()) noexcept {
+  using E = typename T::value_type;
+  auto profile = ProfileInput(data);
+  auto source = limits.calibrated ? " (calibrated)" : " (default)";
+  auto number = [](unsigned long value) { return std::to_string(value); };
+  auto items = number(profile.size) + " items";
+
+  // The profile only samples pairs, so all of the data is checked before trusting it
+  auto later = [](const auto& a, const auto& b) { return b < a; };
+  if (profile.ascending == 1.0 && std::is_sorted(data.begin(), data.end())) {
+    return {"None", items + ", already sorted"};
+  } else if (profile.descending == 1.0 && std::is_sorted(data.begin(), data.end(), later)) {
+    std::reverse(data.begin(), data.end());
+    return {"std::reverse", items + ", sorted in reverse"};
+  }
+
+  if (threads > 1 && profile.size >= limits.parallel_min) {
+    InPlaceCountingBinSort(data, threads);
+    return {
+        "InPlaceCountingBinSort",
+        items + " >= parallel_min " + number(limits.parallel_min) + source + ", on " +
+            number(threads) + " threads"};
+  }
+
+  // Radix passes over digits that never change are skipped, so with narrow keys it wins sooner
+  const bool dups = profile.unique < 0.125;
+  auto radix_min = dups ? limits.dup_radix_min : limits.radix_min;
+  const unsigned passes = E::template NumChunks<16>();
+  const unsigned used = std::max(1U, (profile.key_bits + 15) / 16);
+  radix_min = radix_min / passes * used;
+  auto why = (dups ? " dup_radix_min " : " radix_min ") + number(radix_min) + source + ", " +
+      number(profile.key_bits) + " of " + number(E::KeyBits()) + " key bits vary";
+  if (profile.size >= radix_min) {
+    CountingRadixSort(data);
+    return {"CountingRadixSort", items + " >=" + why};
+  }
+  std::sort(data.begin(), data.end());
+  return {"std::sort", items + " <" + why};
+}
+
+// Find the thresholds for Sort() on this machine, by timing each kernel on random keys (and on
+// keys with few distinct values) of sizes from 256 up to 4M, for element type E made from T.
+template <typename T, typename E>
+SortThresholds Calibrate(int threads, unsigned int seed) noexcept {
+  using dtype = std::vector<E>;
+  auto time = [](const dtype& input, auto func) {
+    long best = LONG_MAX;
+    for (auto run = 0; run < 3; ++run) {
+      dtype data = input;
+      auto start = std::chrono::high_resolution_clock::now();
+      func(data);
+      auto finish = std::chrono::high_resolution_clock::now();
+      best = std::min(best, static_cast<long>((finish - start).count()));
+    }
+    return best;
+  };
+
+  // Each threshold is the smallest size from which the kernel won at every larger size tried
+  SortThresholds limits;
+  limits.calibrated = true;
+  limits.radix_min = limits.dup_radix_min = limits.parallel_min = ULONG_MAX;
+  for (unsigned long size = 0x100; size <= 0x400000; size *= 4) {
+    std::vector<T> keys;
+    GenerateKeys(keys, "random", size, seed);
+    dtype random(keys.begin(), keys.end());
+    GenerateKeys(keys, "few:16", size, seed);
+    dtype few(keys.begin(), keys.end());
+
+    auto sorted = time(random, [](dtype& d) { std::sort(d.begin(), d.end()); });
+    auto radix = time(random, [](dtype& d) { CountingRadixSort(d); });
+    auto dup_sorted = time(few, [](dtype& d) { std::sort(d.begin(), d.end()); });
+    auto dup_radix = time(few, [](dtype& d) { CountingRadixSort(d); });
+    auto parallel = LONG_MAX;
+    if (threads > 1) {
+      parallel = time(random, [threads](dtype& d) { InPlaceCountingBinSort(d, threads); });
+    }
+    std::printf("  %'9lu items: std::sort / CountingRadixSort", size);
+    std::printf(" %'13ldns / %'13ldns, with few keys", sorted, radix);
+    std::printf(" %'13ldns / %'13ldns", dup_sorted, dup_radix);
+    if (threads > 1) {
+      std::printf(", threaded %'13ldns", parallel);
+    }
+    std::printf("\n");
+
+    auto update = [size](unsigned long& limit, bool wins) {
+      if (!wins) {
+        limit = ULONG_MAX;
+      } else if (limit == ULONG_MAX) {
+        limit = size;
+      }
+    };
+    update(limits.radix_min, radix < sorted);
+    update(limits.dup_radix_min, dup_radix < dup_sorted);
+    update(limits.parallel_min, parallel < std::min(sorted, radix));
+  }
+  return limits;
+}
@@ -0,0 +1,420 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <fnmatch.h>
+
+#include "color.hpp"
+#include "data.hpp"
+#include "memstats.hpp"
+#include "perfcount.hpp"
+#include "threadpool.hpp"
+#include "verify.hpp"
+
+// Which input a benchmark entry sorts: the generated data, or a sorted copy of it (for re-runs).
+enum class Input { Unsorted, Sorted };
+
+// Entries that only compute a result (like std::is_sorted()) store it here, so that, with uncounted
+// Data, the optimizer can't delete the work being timed.
+inline volatile bool bench_sink = false;
+
+// Everything measured for one benchmark entry, at one size and thread count.
+struct BenchResult {
+  std::string type;
+  bool counted;
+  std::string distribution;
+  std::string name;
+  unsigned long size;
+  int threads; // Zero for entries that don't take a thread count
+  std::vector<long> times; // In ns, one for each measured run
+  unsigned long comparisons;
+  unsigned long constructions;
+  unsigned long destructions;
+  unsigned long swaps;
+  unsigned long copies;
+  unsigned long moves;
+  unsigned long skipped_passes;
+  unsigned long split_ns;
+  unsigned long leaf_ns;
+  PerfCounters::Counts hardware = {-1, -1, -1, -1, -1, -1}; // Counters that couldn't be read are -1
+  MemoryStats memory;
+  bool correct;
+  long verify_ns = 0; // Checking the output of the last run, which isn't part of the times
+  std::string note; // From the entry itself, such as which kernel it picked
+  std::vector<ThreadPool::Load> loads; // For each pool worker, then the threads outside the pool
+
+  long Percentile(unsigned percent) const noexcept {
+    auto sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[(sorted.size() - 1) * percent / 100];
+  }
+  long Min() const noexcept {
+    return Percentile(0);
+  }
+  long Median() const noexcept {
+    return Percentile(50);
+  }
+  double ElementsPerSecond() const noexcept {
+    return (Median() > 0) ? size * 1e9 / Median() : 0.0;
+  }
+};
+
+// How to run the benchmarks, from the command line, and everything they measured.
+struct BenchConfig {
+  std::vector<std::string> patterns = {"*"}; // Globs of entry names to run
+  std::vector<int> threads; // Thread counts for entries that take one
+  int warmups = 0;
+  int reps = 1;
+  bool list = false; // Just print the names of the entries
+  bool perf = false; // Read the hardware counters around each run
+  std::string distribution; // Of the current input
+  std::vector<BenchResult> results;
+
+  bool Selected(const std::string& name) const noexcept {
+    for (auto& pattern : patterns) {
+      if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// Runs benchmark entries on data of element type E: each entry that is selected is run (after the
+// warm-up runs) the configured number of times, on a fresh copy of its input each time, and only
+// the call to the algorithm itself is timed.  The stats and checks are from the last run, and the
+// output of that run is checked to be sorted, and to be a permutation of the input, by comparing
+// a hash of it to one of the input (found once, at setup), all in parallel, and not timed.
+template <typename E>
+class Bench {
+ public:
+  using dtype = std::vector<E>;
+
+  // The prefix goes on the name of every entry, to tell apart benches of the same type.
+  Bench(
+      const std::string& in_type,
+      BenchConfig& in_config,
+      const dtype& in_unsorted,
+      const std::string& in_prefix = "") noexcept
+      : type(in_type), prefix(in_prefix), config(in_config), unsorted(in_unsorted) {
+    if (!config.list) {
+      input_hash = MultisetHash(unsorted);
+    }
+  }
+
+  void Add(const std::string& name, std::function<void(dtype&)> func, Input in = Input::Unsorted) {
+    Measure<dtype>(name, 0, in, func);
+  }
+
+  // Entries that take a thread count are run once for each configured thread count.
+  void AddThreaded(const std::string& name, std::function<void(dtype&, int)> func) {
+    AddThreadedAs<dtype>(name, func);
+  }
+  template <typename C>
+  void AddThreadedAs(const std::string& name, std::function<void(C&, int)> func) {
+    for (auto threads : config.threads) {
+      Measure<C>(name, threads, Input::Unsorted, [func, threads](C& data) {
+        func(data, threads);
+      });
+    }
+  }
+
+  // Entries that run on a container of type C, which is built from the input before timing.
+  template <typename C>
+  void AddAs(const std::string& name, std::function<void(C&)> func, Input in = Input::Unsorted) {
+    Measure<C>(name, 0, in, func);
+  }
+
+  // Entries that run on a container of type C, which has prep run on it (untimed) first, to
+  // measure what the algorithm does with a container left in a given state.
+  template <typename C>
+  void AddPrepared(
+      const std::string& name, std::function<void(C&)> prep, std::function<void(C&)> func) {
+    Measure<C>(name, 0, Input::Unsorted, func, prep);
+  }
+
+  // Entries that leave the data only partly sorted (such as selections), which are checked by
+  // check instead of by whether the data is sorted.
+  void AddChecked(
+      const std::string& name,
+      std::function<void(dtype&)> func,
+      std::function<bool(const dtype&)> check) {
+    Measure<dtype>(name, 0, Input::Unsorted, func, nullptr, check);
+  }
+
+  // Entries can call this while running, to note something (from the last run) in their result.
+  void Note(const std::string& text) {
+    note = text;
+  }
+
+  // The input, sorted (for the re-runs), which is only sorted when first needed.
+  const dtype& Sorted() noexcept {
+    if (sorted.size() != unsorted.size()) {
+      sorted = unsorted;
+      std::sort(sorted.begin(), sorted.end());
+    }
+    return sorted;
+  }
+
+ private:
+  template <typename C>
+  void Measure(
+      const std::string& entry,
+      int threads,
+      Input in,
+      std::function<void(C&)> func,
+      std::function<void(C&)> prep = nullptr,
+      std::function<bool(const C&)> check = nullptr) {
+    auto name = prefix + entry;
+    if (!config.Selected(name)) {
+      return;
+    } else if (config.list) {
+      if (threads == 0 || threads == config.threads.front()) {
+        printf("%s\n", name.c_str());
+      }
+      return;
+    }
+
+    const dtype& input = (in == Input::Sorted) ? Sorted() : unsorted;
+    BenchResult result = {
+        type, E::IsCounted(), config.distribution, name, input.size(), threads};
+    for (auto run = 0; run < config.warmups + config.reps; ++run) {
+      C data(input.begin(), input.end());
+      if (prep) {
+        prep(data);
+      }
+      E::ResetStats();
+      ThreadPool::Get().ResetLoads();
+      note.clear();
+      StartMemoryStats(name);
+      if (config.perf) {
+        PerfCounters::Get().Start();
+      }
+      auto start = std::chrono::high_resolution_clock::now();
+      func(data);
+      auto finish = std::chrono::high_resolution_clock::now();
+      if (config.perf) {
+        result.hardware = PerfCounters::Get().Stop();
+      }
+      auto memory = StopMemoryStats();
+      if (run >= config.warmups) {
+        result.times.push_back((finish - start).count());
+      }
+      if (run + 1 == config.warmups + config.reps) {
+        auto& stats = E::GetStats();
+        result.comparisons = stats.comparisons;
+        result.constructions = stats.constructions;
+        result.destructions = stats.destructions;
+        result.swaps = stats.swaps;
+        result.copies = stats.copies;
+        result.moves = stats.moves;
+        result.skipped_passes = stats.skipped_passes;
+        result.split_ns = stats.split_ns;
+        result.leaf_ns = stats.leaf_ns;
+        result.memory = memory;
+        result.loads = ThreadPool::Get().GetLoads();
+        result.note = note;
+        auto verify_start = std::chrono::high_resolution_clock::now();
+        result.correct = Verify(data, check);
+        auto verify_finish = std::chrono::high_resolution_clock::now();
+        result.verify_ns = (verify_finish - verify_start).count();
+      }
+    }
+    E::ResetStats();
+    Print(result);
+    config.results.push_back(result);
+  }
+
+  // Whether the output is sorted (or is as check wants it, if given), and, unless it's from an
+  // entry that keeps fewer items than it was given, a permutation of the input.
+  template <typename C>
+  bool Verify(C& data, const std::function<bool(const C&)>& check) {
+    const unsigned long size = ItemsIn(data);
+    if (check) {
+      return check(data) && (size != unsorted.size() || MultisetHash(data) == input_hash);
+    }
+    return size == unsorted.size() && ParallelIsSorted(data) && MultisetHash(data) == input_hash;
+  }
+
+  void Print(const BenchResult& result) noexcept {
+    printf("Took " CRED "%'15ldns" CNRM " for: ", result.Median());
+    printf(CGRN "%s" CNRM, result.name.c_str());
+    if (result.threads > 0) {
+      printf(" (%d threads)", result.threads);
+    }
+    printf("\n");
+    if (result.times.size() > 1) {
+      printf("  " CBLU "%'15ld" CNRM " Min  ", result.Min());
+      printf("  " CBLU "%'15ld" CNRM " P95  ", result.Percentile(95));
+      printf("  " CBLU "%'15lu" CNRM " Runs \n", result.times.size());
+    }
+    printf("  " CBLU "%'15.0f" CNRM " Elements/s", result.ElementsPerSecond());
+    printf("  " CBLU "%'15ld" CNRM " Verify ns (not timed)\n", result.verify_ns);
+    ReportStats(result, result.counted);
+    ReportHardware(result.hardware);
+    ReportMemory(result.memory);
+    if (!result.note.empty()) {
+      printf("  " CYEL "%s" CNRM "\n", result.note.c_str());
+    }
+    if (std::any_of(result.loads.begin(), result.loads.end(), [](auto& l) { return l.busy > 0; })) {
+      // The last column is the threads outside the pool, which run tasks while they wait
+      if (std::any_of(result.loads.begin(), result.loads.end(), [](auto& l) { return l.items; })) {
+        printf("  Per-thread items: ");
+        for (auto& load : result.loads) {
+          printf(" " CBLU "%'lu" CNRM, load.items);
+        }
+        printf("\n");
+      }
+      printf("  Per-thread busy us:");
+      for (auto& load : result.loads) {
+        printf(" " CBLU "%'lu" CNRM, load.busy / 1000);
+      }
+      printf("\n");
+    }
+    if (!result.correct) {
+      printf("  Warning: Data is not correctly sorted, or lost items!!!!!!!!!!!!!!!!!!!!!!!\n");
+    }
+    printf("\n");
+  }
+
+  std::string type;
+  std::string prefix;
+  BenchConfig& config;
+  const dtype& unsorted;
+  dtype sorted;
+  uint64_t input_hash = 0; // MultisetHash() of the input
+  std::string note;
+};
+
+// Write all the results as CSV, with one row per entry, size and thread count.
+inline void WriteCSV(FILE* out, const std::vector<BenchResult>& results) noexcept {
+  fprintf(out, "type,counted,distribution,name,size,threads,runs,");
+  fprintf(out, "min_ns,median_ns,p95_ns,elements_per_s,");
+  fprintf(out, "comparisons,constructions,destructions,swaps,copies,moves,");
+  fprintf(out, "skipped_passes,split_ns,leaf_ns,");
+  for (auto name : PerfCounters::names) {
+    fprintf(out, "%s,", name);
+  }
+  fprintf(out, "alloc_bytes,allocations,peak_heap_bytes,page_faults,peak_rss_bytes,");
+  fprintf(out, "correct,verify_ns,thread_items,thread_busy_ns,note\n");
+  for (auto& result : results) {
+    fprintf(out, "\"%s\",%d,", result.type.c_str(), result.counted);
+    fprintf(out, "\"%s\",\"%s\",", result.distribution.c_str(), result.name.c_str());
+    fprintf(out, "%lu,%d,%lu,", result.size, result.threads, result.times.size());
+    fprintf(out, "%ld,%ld,", result.Min(), result.Median());
+    fprintf(out, "%ld,%.0f,", result.Percentile(95), result.ElementsPerSecond());
+    fprintf(out, "%lu,%lu,", result.comparisons, result.constructions);
+    fprintf(out, "%lu,%lu,", result.destructions, result.swaps);
+    fprintf(out, "%lu,%lu,", result.copies, result.moves);
+    fprintf(out, "%lu,%lu,", result.skipped_passes, result.split_ns);
+    fprintf(out, "%lu,", result.leaf_ns);
+    for (auto count : result.hardware) {
+      if (count >= 0) {
+        fprintf(out, "%ld", count);
+      }
+      fprintf(out, ",");
+    }
+    if (result.memory.heap_counted) {
+      fprintf(out, "%lu,%lu,", result.memory.allocated, result.memory.allocations);
+      fprintf(out, "%lu,", result.memory.peak_heap);
+    } else {
+      fprintf(out, ",,,");
+    }
+    fprintf(out, "%ld,", result.memory.page_faults);
+    if (result.memory.peak_rss >= 0) {
+      fprintf(out, "%ld", result.memory.peak_rss);
+    }
+    fprintf(out, ",%d,%ld,", result.correct, result.verify_ns);
+    for (auto& load : result.loads) {
+      fprintf(out, (&load == &result.loads.front()) ? "\"%lu" : ";%lu", load.items);
+    }
+    for (auto& load : result.loads) {
+      fprintf(out, (&load == &result.loads.front()) ? "\",\"%lu" : ";%lu", load.busy);
+    }
+    fprintf(out, "\",\"%s\"\n", result.note.c_str());
+  }
+}
+
+// Write all the results as a JSON array, with one object per entry, size and thread count.
+inline void WriteJSON(FILE* out, const std::vector<BenchResult>& results) noexcept {
+  fprintf(out, "[");
+  for (auto& result : results) {
+    fprintf(out, (&result == &results.front()) ? "\n" : ",\n");
+    fprintf(out, "  {\"type\": \"%s\", \"counted\": %s, ", result.type.c_str(),
+            result.counted ? "true" : "false");
+    fprintf(out, "\"distribution\": \"%s\", ", result.distribution.c_str());
+    fprintf(out, "\"name\": \"%s\", \"size\": %lu, ", result.name.c_str(), result.size);
+    fprintf(out, "\"threads\": %d, \"times_ns\": [", result.threads);
+    for (auto& time : result.times) {
+      fprintf(out, (&time == &result.times.front()) ? "%ld" : ", %ld", time);
+    }
+    fprintf(out, "], \"min_ns\": %ld, \"median_ns\": %ld, ", result.Min(), result.Median());
+    fprintf(out, "\"p95_ns\": %ld, ", result.Percentile(95));
+    fprintf(out, "\"elements_per_s\": %.0f, ", result.ElementsPerSecond());
+    fprintf(out, "\"comparisons\": %lu, ", result.comparisons);
+    fprintf(out, "\"constructions\": %lu, ", result.constructions);
+    fprintf(out, "\"destructions\": %lu, ", result.destructions);
+    fprintf(out, "\"swaps\": %lu, \"copies\": %lu, ", result.swaps, result.copies);
+    fprintf(out, "\"moves\": %lu, \"skipped_passes\": %lu, ", result.moves, result.skipped_passes);
+    fprintf(out, "\"split_ns\": %lu, \"leaf_ns\": %lu, ", result.split_ns, result.leaf_ns);
+    for (int event = 0; event < PerfCounters::num_events; ++event) {
+      fprintf(out, "\"%s\": ", PerfCounters::names[event]);
+      if (result.hardware[event] >= 0) {
+        fprintf(out, "%ld, ", result.hardware[event]);
+      } else {
+        fprintf(out, "null, ");
+      }
+    }
+    if (result.memory.heap_counted) {
+      fprintf(out, "\"alloc_bytes\": %lu, ", result.memory.allocated);
+      fprintf(out, "\"allocations\": %lu, ", result.memory.allocations);
+      fprintf(out, "\"peak_heap_bytes\": %lu, ", result.memory.peak_heap);
+    } else {
+      fprintf(out, "\"alloc_bytes\": null, \"allocations\": null, \"peak_heap_bytes\": null, ");
+    }
+    fprintf(out, "\"page_faults\": %ld, \"peak_rss_bytes\": ", result.memory.page_faults);
+    if (result.memory.peak_rss >= 0) {
+      fprintf(out, "%ld, ", result.memory.peak_rss);
+    } else {
+      fprintf(out, "null, ");
+    }
+    fprintf(out, "\"correct\": %s, ", result.correct ? "true" : "false");
+    fprintf(out, "\"verify_ns\": %ld, \"thread_items\": [", result.verify_ns);
+    for (auto& load : result.loads) {
+      fprintf(out, (&load == &result.loads.front()) ? "%lu" : ", %lu", load.items);
+    }
+    fprintf(out, "], \"thread_busy_ns\": [");
+    for (auto& load : result.loads) {
+      fprintf(out, (&load == &result.loads.front()) ? "%lu" : ", %lu", load.busy);
+    }
+    fprintf(out, "], \"note\": \"%s\"}", result.note.c_str());
+  }
+  fprintf(out, "\n]\n");
+}
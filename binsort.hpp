@@ -19,17 +19,64 @@
 //
 // *************************************************************************
 
-template <typename T>
-void BinSort(T& data) noexcept {
-  constexpr unsigned long num_bins = T::value_type::NumBins();
-  T bins[num_bins];
+#pragma once
+
+#include <memory>
+#include <vector>
 
-  // Splice data into bins
-  while (!data.empty()) {
-    auto it = data.cbefore_begin();
-    auto bin = next(it)->GetBin(it->NumChunks() - 1);
-    bins[bin].splice_after(bins[bin].cbefore_begin(), data, it);
+// Move every item after before (up to stop) from the list onto the tail of its bin in table, so
+// the bins keep the items in order.  The node of the next item is prefetched while each one is
+// moved.  If counts isn't null, it counts the items put into each bin.
+template <unsigned Bits, typename T, typename I>
+void AppendToBins(
+    T& from,
+    I before,
+    I stop,
+    T* table,
+    I* tails,
+    unsigned long* counts,
+    uint_fast8_t chunk) noexcept {
+  for (auto it = next(before); it != stop; it = next(before)) {
+    auto after = next(it);
+    if (after != stop) {
+      __builtin_prefetch(&*after);
+    }
+    auto bin = it->template GetBin<Bits>(chunk);
+    table[bin].splice_after(tails[bin], from, before);
+    ++tails[bin];
+    if (counts != nullptr) {
+      ++counts[bin];
+    }
   }
+}
+
+// Move every item from the list to after place, in order, leaving place at the last one moved.
+template <typename T, typename I>
+void AppendAll(T& to, I& place, T& from) noexcept {
+  while (!from.empty()) {
+    auto after = next(from.cbegin());
+    if (after != from.cend()) {
+      __builtin_prefetch(&*after);
+    }
+    to.splice_after(place, from, from.cbefore_begin());
+    ++place;
+  }
+}
+
+template <unsigned Bits = 16, typename T>
+void BinSort(T& data) noexcept {
+  using I = typename T::const_iterator;
+  constexpr unsigned long num_bins = T::value_type::template NumBins<Bits>();
+  constexpr uint_fast8_t chunk = T::value_type::template NumChunks<Bits>() - 1;
+  auto bins = std::make_unique<T[]>(num_bins);
+  std::vector<I> tails;
+  for (unsigned long bin = 0; bin < num_bins; ++bin) {
+    tails.push_back(bins[bin].cbefore_begin());
+  }
+
+  // Append data to the bins, which keeps each in input order (so sorted input stays sorted)
+  AppendToBins<Bits>(
+      data, data.cbefore_begin(), data.cend(), bins.get(), tails.data(), nullptr, chunk);
 
   // Sort each bin, and then splice sorted data back out of bins
   auto place = data.cbefore_begin();
@@ -37,9 +84,6 @@ void BinSort(T& data) noexcept {
     if (!is_sorted(bins[bin].cbegin(), bins[bin].cend())) {
       bins[bin].sort();
     }
-    while (!bins[bin].empty()) {
-      data.splice_after(place, bins[bin], bins[bin].cbefore_begin());
-      ++place;
-    }
+    AppendAll(data, place, bins[bin]);
   }
 }
@@ -19,144 +19,356 @@
 //
 // *************************************************************************
 
-#include <future>
+#pragma once
 
-template <typename T, typename A>
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <vector>
+
+#include "cradixsort.hpp"
+#include "threadpool.hpp"
+
+template <unsigned Bits, typename T>
+void CountingBinSort(
+    T begin,
+    T end,
+    bool in_place,
+    int threads,
+    uint_fast8_t chunk,
+    const bool* varies) noexcept;
+
+// The next chunk below the given one that varies anywhere in the data, or -1 if none does.
+inline int NextVaryingChunk(const bool* varies, int chunk) noexcept {
+  while (--chunk >= 0 && !varies[chunk]) {
+  }
+  return chunk;
+}
+
+template <unsigned Bits, typename T, typename A>
 void CountingBinSubSort(
     T begin,
     T end,
     unsigned long offset,
     const A& count,
     bool in_place,
-    uint_fast8_t chunk) noexcept {
+    uint_fast8_t chunk,
+    const bool* varies,
+    int threads = 1) noexcept {
+  const int next_chunk = NextVaryingChunk(varies, chunk);
   for (unsigned long bin = 0; bin < count.size(); ++bin) {
     auto next_offset = count[bin];
     using std::is_sorted;
     auto size = next_offset - offset;
+    bool handed_on = false;
     if (!is_sorted(begin + offset, begin + next_offset)) {
-      if (size > 1024 && chunk > 0) {
-        CountingBinSort(begin + offset, begin + next_offset, in_place, 1, chunk - 1);
+      if (size > 1024 && next_chunk >= 0) {
+        CountingBinSort<Bits>(
+            begin + offset, begin + next_offset, in_place, threads, next_chunk, varies);
+        handed_on = (threads > 1);
       } else {
         using std::sort;
         sort(begin + offset, begin + next_offset);
       }
     }
+    if (threads > 1 && !handed_on) {
+      // This task was given the threads to split the bin up, but did it all itself
+      ThreadPool::Get().CountItems(size);
+    }
     offset = next_offset;
   }
 }
 
-template <typename T>
-void CountingBinSort(T begin, T end, bool in_place, int threads, uint_fast8_t chunk) noexcept {
-  std::array<unsigned long, T::value_type::NumBins()> count = {};
+// Count the items in each bin for the chunk, with each thread counting its own slice.
+template <unsigned Bits, typename T, typename A>
+void CountBins(T begin, T end, uint_fast8_t chunk, int threads, A& count) noexcept {
+  using E = typename std::iterator_traits<T>::value_type;
+  if (threads < 2) {
+    ForEachKey(begin, end, [&count, chunk](auto, auto key) {
+      ++count[E::template KeyBin<Bits>(key, chunk)];
+    });
+    return;
+  }
+
+  const unsigned long size = end - begin;
+  const unsigned long step = (size + threads - 1) / threads;
+  std::vector<std::vector<unsigned long>> counts(threads);
+  TaskGroup group;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto first = begin + std::min(size, step * thread);
+    auto last = begin + std::min(size, step * (thread + 1));
+    group.Spawn([first, last, chunk, cnt = &counts[thread]]() {
+      cnt->resize(E::template NumBins<Bits>());
+      ForEachKey(first, last, [cnt, chunk](auto, auto key) {
+        ++(*cnt)[E::template KeyBin<Bits>(key, chunk)];
+      });
+      first->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+  for (auto& cnt : counts) {
+    for (unsigned long bin = 0; bin < cnt.size(); ++bin) {
+      count[bin] += cnt[bin];
+    }
+  }
+}
+
+// Parallel version of the in-place permutation (after PARADIS), for offsets in count, which are
+// left as the end of each bin.  Each round, the part of each bin still to be done is cut into a
+// stripe per thread, and each thread moves the items in its stripes to its own stripes of their
+// bins, as far as those have room.  Then each bin is repaired by partitioning the items that still
+// don't belong in it to its front, and only those are left for the next round.  Once few items are
+// left (or a round doesn't help), the last round is done by one thread, which always finishes.
+template <unsigned Bits, typename T, typename A>
+void ParallelInPlacePermute(T begin, T end, uint_fast8_t chunk, int threads, A& count) noexcept {
+  constexpr unsigned long num_bins = std::iterator_traits<T>::value_type::template NumBins<Bits>();
+  const unsigned long size = end - begin;
+
+  // The part of each bin still to be done
+  std::vector<unsigned long> head(count.begin(), count.end());
+  std::vector<unsigned long> tail(num_bins);
+  for (unsigned long bin = 0; bin < num_bins; ++bin) {
+    count[bin] = tail[bin] = (bin + 1 < num_bins) ? head[bin + 1] : size;
+  }
+
+  std::vector<unsigned long> stripe_head(num_bins * threads);
+  std::vector<unsigned long> stripe_tail(num_bins * threads);
+  unsigned long left = size;
+  while (left > 0) {
+    const int round_threads = (left > 0x10000) ? threads : 1;
+    for (auto thread = 0; thread < round_threads; ++thread) {
+      for (unsigned long bin = 0; bin < num_bins; ++bin) {
+        auto bin_size = tail[bin] - head[bin];
+        stripe_head[num_bins * thread + bin] = head[bin] + bin_size * thread / round_threads;
+        stripe_tail[num_bins * thread + bin] = head[bin] + bin_size * (thread + 1) / round_threads;
+      }
+    }
+
+    TaskGroup group;
+    for (auto thread = 0; thread < round_threads; ++thread) {
+      auto sh = stripe_head.begin() + num_bins * thread;
+      auto st = stripe_tail.begin() + num_bins * thread;
+      group.Spawn([begin, chunk, sh, st]() {
+        // Each stripe ends up with the items that belong there, then the ones that didn't fit
+        for (unsigned long bin = 0; bin < num_bins; ++bin) {
+          for (auto place = sh[bin]; place < st[bin]; ++place) {
+            auto temp = begin[place];
+            auto dest = temp.template GetBin<Bits>(chunk);
+            while (dest != bin && sh[dest] < st[dest]) {
+              using std::swap;
+              swap(temp, begin[sh[dest]++]);
+              dest = temp.template GetBin<Bits>(chunk);
+            }
+            if (dest == bin) {
+              begin[place] = begin[sh[bin]];
+              begin[sh[bin]++] = temp;
+            } else {
+              begin[place] = temp;
+            }
+          }
+        }
+        begin->GetStats(); // Must manually force a stats flush before this task moves on.
+      });
+    }
+    group.Wait();
+
+    // Repair: move the items that don't belong in each bin to its front, for the next round
+    for (auto thread = 0; thread < round_threads; ++thread) {
+      auto first = num_bins * thread / round_threads;
+      auto last = num_bins * (thread + 1) / round_threads;
+      group.Spawn([begin, chunk, first, last, &head, &tail]() {
+        for (auto bin = first; bin < last; ++bin) {
+          auto mid = std::partition(
+              begin + head[bin], begin + tail[bin], [bin, chunk](const auto& item) {
+                return item.template GetBin<Bits>(chunk) != bin;
+              });
+          tail[bin] = mid - begin;
+        }
+        begin->GetStats(); // Must manually force a stats flush before this task moves on.
+      });
+    }
+    group.Wait();
+
+    unsigned long now_left = 0;
+    for (unsigned long bin = 0; bin < num_bins; ++bin) {
+      now_left += tail[bin] - head[bin];
+    }
+    if (now_left == left) {
+      threads = 1;
+    }
+    left = now_left;
+  }
+}
+
+// Sort on the given chunk, then on each of the lower chunks that vary (as marked in varies).
+template <unsigned Bits, typename T>
+void CountingBinSort(
+    T begin,
+    T end,
+    bool in_place,
+    int threads,
+    uint_fast8_t chunk,
+    const bool* varies) noexcept {
+  std::array<unsigned long, T::value_type::template NumBins<Bits>()> count = {};
 
   // Count the items in each bin for the last chunk
-  for (auto it = begin; it != end; ++it) {
-    ++count[it->GetBin(chunk)];
+  CountBins<Bits>(begin, end, chunk, threads, count);
+  // If every item is in the same bin, this chunk sorts nothing: skip straight to the next one
+  const unsigned long size = end - begin;
+  if (size > 0 && count[begin->template GetBin<Bits>(chunk)] == size) {
+    T::value_type::CountSkippedPass();
+    auto next_chunk = NextVaryingChunk(varies, chunk);
+    if (next_chunk >= 0) {
+      CountingBinSort<Bits>(begin, end, in_place, threads, next_chunk, varies);
+    } else if (threads > 1) {
+      ThreadPool::Get().CountItems(size); // All equal, so no tasks will count them
+    }
+    return;
   }
   // Convert counts to offsets
   unsigned long offset = 0;
-  for (unsigned long bin = 0; bin < T::value_type::NumBins(); ++bin) {
+  for (unsigned long bin = 0; bin < T::value_type::template NumBins<Bits>(); ++bin) {
     auto next_offset = offset + count[bin];
     count[bin] = offset;
     offset = next_offset;
   }
 
-  if (in_place) {
+  if (in_place && threads > 1) {
+    ParallelInPlacePermute<Bits>(begin, end, chunk, threads, count);
+  } else if (in_place) {
     // Swap all elements into their correct palces (in-place, non-stable version)
     auto place = count;
     for (auto it = begin; it != end; ++it) {
-      if (count[it->GetBin(chunk)] != static_cast<unsigned long>(it - begin)) {
+      if (count[it->template GetBin<Bits>(chunk)] != static_cast<unsigned long>(it - begin)) {
         auto temp = *it;
         offset = static_cast<unsigned long>(1 + it - begin);
         while (offset != static_cast<unsigned long>(it - begin)) {
-          auto bin = temp.GetBin(chunk);
+          auto bin = temp.template GetBin<Bits>(chunk);
           offset = place[bin]++;
           using std::swap;
           swap(temp, begin[offset]);
         }
       }
-      ++count[it->GetBin(chunk)];
+      ++count[it->template GetBin<Bits>(chunk)];
     }
   } else {
     // Copy list, then copy back to the right place in the data array (stable version)
     std::vector<typename T::value_type> other(begin, end);
     for (auto it = other.cbegin(); it != other.cend(); ++it) {
-      auto bin = it->GetBin(chunk);
+      auto bin = it->template GetBin<Bits>(chunk);
       begin[count[bin]++] = *it;
     }
   }
 
   if (threads < 2) {
-    CountingBinSubSort(begin, end, 0, count, in_place, chunk);
+    CountingBinSubSort<Bits>(begin, end, 0, count, in_place, chunk, varies);
   } else {
-    std::vector<std::future<void>> futures;
+    TaskGroup group;
+    auto spawn = [&group, begin, end, in_place, chunk, varies](
+                     unsigned long offset, std::vector<unsigned long> cnt, int sub_threads) {
+      group.Spawn([begin, end, offset, cnt, in_place, chunk, varies, sub_threads]() {
+        CountingBinSubSort<Bits>(begin, end, offset, cnt, in_place, chunk, varies, sub_threads);
+        if (sub_threads == 1) {
+          ThreadPool::Get().CountItems(cnt.back() - offset); // Split bins count their own
+        }
+        begin->GetStats(); // Must manually force a stats flush before this task moves on.
+      });
+    };
 
-    auto step = T::value_type::NumBins() / threads;
+    // Split the bins into runs of about an equal share of the items for each thread, rather than
+    // an equal number of bins, so skewed data doesn't leave it all to one thread.  A bin bigger
+    // than a share gets a task of its own, which splits it up over as many threads as its shares.
+    const auto num_bins = T::value_type::template NumBins<Bits>();
+    const unsigned long share = std::max(1L, (end - begin) / threads);
+    unsigned long first = 0;
     unsigned long offset = 0;
-    for (auto thread = 0; thread < threads; ++thread) {
-      unsigned long next_offset = count[step * (thread + 1) - 1];
-      std::vector<unsigned long> cnt(
-          count.begin() + step * thread, count.begin() + step * (thread + 1));
-
-      futures.push_back(
-          std::async(std::launch::async, [begin, end, offset, cnt, in_place, chunk]() {
-            CountingBinSubSort(begin, end, offset, cnt, in_place, chunk);
-            begin->GetStats(); // Must manually force a stats flush before this thread goes away.
-          }));
-
-      offset = next_offset;
+    for (unsigned long bin = 0; bin < num_bins; ++bin) {
+      auto bin_offset = (bin > 0) ? count[bin - 1] : 0;
+      if (count[bin] - bin_offset > share) {
+        if (first < bin) {
+          spawn(offset, {count.begin() + first, count.begin() + bin}, 1);
+        }
+        auto shares = std::min<unsigned long>(threads, (count[bin] - bin_offset) / share);
+        spawn(bin_offset, {count[bin]}, shares);
+        first = bin + 1;
+        offset = count[bin];
+      } else if (count[bin] - offset >= share || bin + 1 == num_bins) {
+        spawn(offset, {count.begin() + first, count.begin() + bin + 1}, 1);
+        first = bin + 1;
+        offset = count[bin];
+      }
     }
-    for (auto& fut : futures) {
-      fut.get();
+    group.Wait();
+  }
+}
+
+// Find the chunks that vary anywhere in the data first, so the chunks that never do (such as those
+// of the fields of a composite key that are the same in every item) are skipped without counting
+// them, which every bin would otherwise do again on its own.
+template <unsigned Bits, typename T>
+void CountingBinSort(T& data, bool in_place, int threads) noexcept {
+  auto varies = FindVaryingChunks<Bits>(data, threads);
+  for (auto chunk_varies : varies) {
+    if (!chunk_varies) {
+      T::value_type::CountSkippedPass();
     }
-    futures.clear();
+  }
+  auto chunk = NextVaryingChunk(varies.data(), varies.size());
+  if (chunk >= 0) {
+    CountingBinSort<Bits>(data.begin(), data.end(), in_place, threads, chunk, varies.data());
   }
 }
 
-// Stable, Not In-Place
-template <typename T>
-void StableCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), false, 1, T::value_type::NumChunks() - 1);
+// Stable, Not In-Place, Optionally Threaded
+template <unsigned Bits = 16, typename T>
+void StableCountingBinSort(T& data, int threads = 1) noexcept {
+  if (AlreadyOrdered(data.begin(), data.end())) {
+    return;
+  }
+  CountingBinSort<Bits>(data, false, threads);
 }
 
-// In-Place, Not Stable
-template <typename T>
-void InPlaceCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), true, 1, T::value_type::NumChunks() - 1);
+// In-Place, Not Stable, Optionally Threaded
+template <unsigned Bits = 16, typename T>
+void InPlaceCountingBinSort(T& data, int threads = 1) noexcept {
+  if (AlreadyOrdered(data.begin(), data.end())) {
+    return;
+  }
+  CountingBinSort<Bits>(data, true, threads);
 }
 
 // Stable, Not In-Place, 2 Threads
-template <typename T>
+template <unsigned Bits = 16, typename T>
 void DualStableCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), false, 2, T::value_type::NumChunks() - 1);
+  StableCountingBinSort<Bits>(data, 2);
 }
 
 // In-Place, Not Stable, 2 Threads
-template <typename T>
+template <unsigned Bits = 16, typename T>
 void DualInPlaceCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), true, 2, T::value_type::NumChunks() - 1);
+  InPlaceCountingBinSort<Bits>(data, 2);
 }
 
 // Stable, Not In-Place, 4 Threads
-template <typename T>
+template <unsigned Bits = 16, typename T>
 void QuadStableCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), false, 4, T::value_type::NumChunks() - 1);
+  StableCountingBinSort<Bits>(data, 4);
 }
 
 // In-Place, Not Stable, 4 Threads
-template <typename T>
+template <unsigned Bits = 16, typename T>
 void QuadInPlaceCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), true, 4, T::value_type::NumChunks() - 1);
+  InPlaceCountingBinSort<Bits>(data, 4);
 }
 
 // Stable, Not In-Place, 8 Threads
-template <typename T>
+template <unsigned Bits = 16, typename T>
 void OctoStableCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), false, 8, T::value_type::NumChunks() - 1);
+  StableCountingBinSort<Bits>(data, 8);
 }
 
 // In-Place, Not Stable, 8 Threads
-template <typename T>
+template <unsigned Bits = 16, typename T>
 void OctoInPlaceCountingBinSort(T& data) noexcept {
-  CountingBinSort(data.begin(), data.end(), true, 8, T::value_type::NumChunks() - 1);
+  InPlaceCountingBinSort<Bits>(data, 8);
 }
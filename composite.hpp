@@ -0,0 +1,201 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "data.hpp"
+
+// Composite keys, of several fields compared one after another (as with a tuple), where each
+// field can be in ascending or descending order.  The radix key of a Composite is the keys of its
+// fields (as Data<> makes them, so signed and floating point fields order right), one after the
+// other, with the bits of each descending field flipped.  Sorted as Data<Composite<...>>, every
+// sort of Data<> elements sorts them, and the radix and bin sorts skip the digits of any fields
+// that are the same in every item, as they do for any other digits that never change.
+
+// Descriptor of one field of a Composite: its type, and whether it sorts in descending order.
+template <typename T, bool Descending = false>
+struct Field {
+  using type = T;
+  using Key = typename Data<T, false>::Key;
+  constexpr static bool descending = Descending;
+  constexpr static unsigned KeyBits() noexcept {
+    return Data<T, false>::KeyBits();
+  }
+  // The key of the value, made to order the same way the field does.
+  static Key GetKey(const T& value) noexcept {
+    T field = value;
+    if constexpr (std::is_floating_point_v<T>) {
+      if (field == T(0)) {
+        field = T(0); // -0.0 equals 0.0, so it must get the same key, or later fields won't count
+      }
+    }
+    auto key = Data<T, false>(field).GetKey();
+    if constexpr (Descending) {
+      key = ~key;
+      if constexpr (KeyBits() < sizeof(Key) * 8) {
+        key &= (Key(1) << KeyBits()) - 1;
+      }
+    }
+    return key;
+  }
+};
+template <typename T>
+using Ascending = Field<T, false>;
+template <typename T>
+using Descending = Field<T, true>;
+
+// Unsigned integer of Words 64-bit words, with only what the sorts do with keys, for composite
+// keys wider than the widest built-in integer.
+template <unsigned Words>
+struct WideKey {
+  std::array<uint64_t, Words> words = {}; // Least significant first
+
+  constexpr WideKey() noexcept = default;
+  constexpr WideKey(unsigned __int128 value) noexcept {
+    words[0] = static_cast<uint64_t>(value);
+    words[1] = static_cast<uint64_t>(value >> 64);
+  }
+  // The lowest bits, for a digit
+  constexpr explicit operator unsigned long() const noexcept {
+    return words[0];
+  }
+
+  constexpr WideKey operator<<(unsigned shift) const noexcept {
+    WideKey out;
+    for (unsigned word = shift / 64; word < Words; ++word) {
+      out.words[word] = words[word - shift / 64] << (shift % 64);
+      if (shift % 64 != 0 && word > shift / 64) {
+        out.words[word] |= words[word - shift / 64 - 1] >> (64 - shift % 64);
+      }
+    }
+    return out;
+  }
+  constexpr WideKey operator>>(unsigned shift) const noexcept {
+    WideKey out;
+    for (unsigned word = 0; word + shift / 64 < Words; ++word) {
+      out.words[word] = words[word + shift / 64] >> (shift % 64);
+      if (shift % 64 != 0 && word + shift / 64 + 1 < Words) {
+        out.words[word] |= words[word + shift / 64 + 1] << (64 - shift % 64);
+      }
+    }
+    return out;
+  }
+  constexpr WideKey& operator|=(const WideKey& other) noexcept {
+    for (unsigned word = 0; word < Words; ++word) {
+      words[word] |= other.words[word];
+    }
+    return *this;
+  }
+  constexpr WideKey& operator^=(const WideKey& other) noexcept {
+    for (unsigned word = 0; word < Words; ++word) {
+      words[word] ^= other.words[word];
+    }
+    return *this;
+  }
+  friend constexpr WideKey operator|(WideKey a, const WideKey& b) noexcept {
+    return a |= b;
+  }
+  friend constexpr WideKey operator^(WideKey a, const WideKey& b) noexcept {
+    return a ^= b;
+  }
+  friend constexpr bool operator==(const WideKey& a, const WideKey& b) noexcept {
+    return a.words == b.words;
+  }
+};
+
+// Smallest unsigned integer type of at least Bits bits.
+template <unsigned Bits>
+using KeyOfBits = std::conditional_t<
+    Bits <= 64,
+    uint64_t,
+    std::conditional_t<Bits <= 128, unsigned __int128, WideKey<(Bits + 63) / 64>>>;
+
+// Value of several fields, compared in order, each ascending or descending as its Field says.
+// Made from the values of the fields, as in Composite<Ascending<uint32_t>, Descending<double>>(
+// tenant, score), and read with Get<0>(), Get<1>(), and so on.
+template <typename... Fields>
+class Composite {
+ public:
+  using Key = KeyOfBits<(Fields::KeyBits() + ...)>;
+
+  Composite() noexcept = default;
+  Composite(const typename Fields::type&... values) noexcept : fields(values...) {}
+
+  template <std::size_t I>
+  const auto& Get() const noexcept {
+    return std::get<I>(fields);
+  }
+
+  bool operator<(const Composite& other) const noexcept {
+    return Less(other, std::index_sequence_for<Fields...>());
+  }
+  bool operator==(const Composite& other) const noexcept {
+    return fields == other.fields;
+  }
+
+  constexpr static unsigned KeyBits() noexcept {
+    return (Fields::KeyBits() + ...);
+  }
+  // The keys of the fields, with the first field's in the top bits.
+  Key GetKey() const noexcept {
+    return MakeKey(std::index_sequence_for<Fields...>());
+  }
+
+ private:
+  template <std::size_t... I>
+  bool Less(const Composite& other, std::index_sequence<I...>) const noexcept {
+    // The first field that isn't equal decides (in its own order)
+    int order = 0;
+    (((order = FieldOrder<Fields>(std::get<I>(fields), std::get<I>(other.fields))) != 0) || ...);
+    return order < 0;
+  }
+  template <typename F>
+  static int FieldOrder(const typename F::type& a, const typename F::type& b) noexcept {
+    if (a < b) {
+      return F::descending ? 1 : -1;
+    } else if (b < a) {
+      return F::descending ? -1 : 1;
+    }
+    return 0;
+  }
+
+  template <std::size_t... I>
+  Key MakeKey(std::index_sequence<I...>) const noexcept {
+    Key key = 0;
+    ((key = Append<Fields>(key, std::get<I>(fields))), ...);
+    return key;
+  }
+  template <typename F>
+  static Key Append(Key key, const typename F::type& value) noexcept {
+    if constexpr (F::KeyBits() < sizeof(Key) * 8) {
+      key = key << F::KeyBits();
+    }
+    return key | Key(F::GetKey(value));
+  }
+
+  std::tuple<typename Fields::type...> fields;
+};
@@ -19,58 +19,213 @@
 //
 // *************************************************************************
 
-template <typename T>
-void CountingRadixSort(T& data) noexcept {
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <vector>
+
+#include "threadpool.hpp"
+
+// The keys are taken from the items in batches (see ForEachKey()), rather than one digit at a
+// time, so the counting and copying loops don't spend their time getting the digits.
+
+// One LSD pass over a single chunk, copying from "from" to the right place in "to", using the
+// given number of threads.  Each thread counts its own slice, then every thread scatters its own
+// slice at once, using offsets ordered by bin and then by thread, so the pass stays stable.
+template <unsigned Bits, typename T>
+void CountingRadixPass(const T& from, T& to, uint_fast8_t chunk, int threads) noexcept {
+  using E = typename T::value_type;
+  constexpr unsigned long num_bins = E::template NumBins<Bits>();
+  const unsigned long size = from.size();
+  const unsigned long step = (size + threads - 1) / threads;
+  std::vector<unsigned long> count(num_bins * threads);
+  TaskGroup group;
+
+  // Count the items for each bin, separately for each thread's slice
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto cnt = count.begin() + num_bins * thread;
+    auto begin = from.cbegin() + std::min(size, step * thread);
+    auto end = from.cbegin() + std::min(size, step * (thread + 1));
+    group.Spawn([begin, end, cnt, chunk]() {
+      ForEachKey(begin, end, [cnt, chunk](auto, auto key) {
+        ++cnt[E::template KeyBin<Bits>(key, chunk)];
+      });
+      begin->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+
+  // Convert counts to offsets, with each thread's part of a bin after the previous thread's
+  unsigned long offset = 0;
+  for (unsigned long bin = 0; bin < num_bins; ++bin) {
+    for (auto thread = 0; thread < threads; ++thread) {
+      auto next_offset = offset + count[num_bins * thread + bin];
+      count[num_bins * thread + bin] = offset;
+      offset = next_offset;
+    }
+  }
+
+  // Copy each thread's slice to the right place in the other array
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto cnt = count.begin() + num_bins * thread;
+    auto begin = from.cbegin() + std::min(size, step * thread);
+    auto end = from.cbegin() + std::min(size, step * (thread + 1));
+    auto dest = to.begin();
+    group.Spawn([begin, end, cnt, dest, chunk]() {
+      ForEachKey(begin, end, [cnt, dest, chunk](auto it, auto key) {
+        dest[cnt[E::template KeyBin<Bits>(key, chunk)]++] = *it;
+      });
+      begin->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+}
+
+// Find which chunks vary at all across the data, using the given number of threads.  A pass over a
+// chunk with the same digit for every item would not move anything, so it can be skipped.  Each
+// thread stops scanning as soon as it has seen every chunk vary, so random data costs very little.
+template <unsigned Bits, typename T>
+auto FindVaryingChunks(const T& data, int threads) noexcept {
+  using E = typename T::value_type;
+  constexpr auto num_chunks = E::template NumChunks<Bits>();
+  std::array<bool, num_chunks> varies = {};
+  if (data.empty()) {
+    return varies;
+  }
+
+  // Every bit that differs from the first key anywhere gets set in one of these
+  typename E::Key first;
+  E::GetKeys(&data.front(), 1, &first);
+  std::vector<typename E::Key> differs(threads);
+  auto all_vary = [](typename E::Key diff) {
+    for (uint_fast8_t chunk = 0; chunk < num_chunks; ++chunk) {
+      if (E::template KeyBin<Bits>(diff, chunk) == 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  const unsigned long size = data.size();
+  const unsigned long step = (size + threads - 1) / threads;
+  TaskGroup group;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto begin = data.cbegin() + std::min(size, step * thread);
+    auto end = data.cbegin() + std::min(size, step * (thread + 1));
+    group.Spawn([begin, end, first, all_vary, diff = &differs[thread]]() {
+      constexpr long batch = 4096;
+      for (auto it = begin; it != end && !all_vary(*diff); it += std::min(batch, end - it)) {
+        ForEachKey(it, it + std::min(batch, end - it), [first, diff](auto, auto key) {
+          *diff |= key ^ first;
+        });
+      }
+      begin->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+
+  for (auto diff : differs) {
+    for (uint_fast8_t chunk = 0; chunk < num_chunks; ++chunk) {
+      varies[chunk] = varies[chunk] || E::template KeyBin<Bits>(diff, chunk) != 0;
+    }
+  }
+  return varies;
+}
+
+template <unsigned Bits = 16, typename T>
+void CountingRadixSort(T& data, int threads = 1) noexcept {
+  using E = typename T::value_type;
+  constexpr auto num_chunks = E::template NumChunks<Bits>();
+  constexpr auto num_bins = E::template NumBins<Bits>();
+  if (AlreadyOrdered(data.begin(), data.end())) {
+    return;
+  }
   auto other = data;
-  unsigned long count[T::value_type::NumChunks()][T::value_type::NumBins()] = {};
+  auto from = &data;
+  auto to = &other;
+
+  if (threads > 1) {
+    auto varies = FindVaryingChunks<Bits>(data, threads);
+
+    // Alternate between the two arrays, starting with whichever one makes the last pass end in data
+    if ((std::count(varies.begin(), varies.end(), true) & 1) != 0) {
+      std::swap(from, to);
+    }
+    for (uint_fast8_t chunk = 0; chunk < num_chunks; ++chunk) {
+      if (varies[chunk]) {
+        CountingRadixPass<Bits>(*from, *to, chunk, threads);
+        std::swap(from, to);
+      } else {
+        E::CountSkippedPass();
+      }
+    }
+    return;
+  }
+
+  // On the heap, as wide (composite) keys have enough chunks to overflow a thread's stack
+  std::vector<std::array<unsigned long, num_bins>> count(num_chunks);
 
   // Count the items for each bin
-  for (auto it = other.cbegin(); it != other.cend(); ++it) {
-    for (uint_fast8_t chunk = 0; chunk < T::value_type::NumChunks(); ++chunk) {
-      ++count[chunk][it->GetBin(chunk)];
+  ForEachKey(other.cbegin(), other.cend(), [&count](auto, auto key) {
+    for (uint_fast8_t chunk = 0; chunk < num_chunks; ++chunk) {
+      ++count[chunk][E::template KeyBin<Bits>(key, chunk)];
     }
+  });
+  // A chunk varies unless one bin got every item
+  std::array<bool, num_chunks> varies = {};
+  for (uint_fast8_t chunk = 0; chunk < num_chunks && !data.empty(); ++chunk) {
+    varies[chunk] = count[chunk][data.front().template GetBin<Bits>(chunk)] != data.size();
   }
   // Convert counts to offsets
-  for (uint_fast8_t chunk = 0; chunk < T::value_type::NumChunks(); ++chunk) {
+  for (uint_fast8_t chunk = 0; chunk < num_chunks; ++chunk) {
     unsigned long offset = 0;
-    for (unsigned long bin = 0; bin < T::value_type::NumBins(); ++bin) {
+    for (unsigned long bin = 0; bin < num_bins; ++bin) {
       auto new_offset = offset + count[chunk][bin];
       count[chunk][bin] = offset;
       offset = new_offset;
     }
   }
 
-  // Copy to the right place in the other array
-  if (T::value_type::NumChunks() > 3) {
-    auto chunk = T::value_type::NumChunks() - 4;
-    for (auto it = data.cbegin(); it != data.cend(); ++it) {
-      auto bin = it->GetBin(chunk);
-      other[count[chunk][bin]++] = *it;
-    }
+  // Copy to the right place in the other array, once per varying chunk, ending back in data
+  if ((std::count(varies.begin(), varies.end(), true) & 1) != 0) {
+    std::swap(from, to);
   }
-
-  // Copy to the right place in the other array
-  if (T::value_type::NumChunks() > 2) {
-    auto chunk = T::value_type::NumChunks() - 3;
-    for (auto it = other.cbegin(); it != other.cend(); ++it) {
-      auto bin = it->GetBin(chunk);
-      data[count[chunk][bin]++] = *it;
+  for (uint_fast8_t chunk = 0; chunk < num_chunks; ++chunk) {
+    if (!varies[chunk]) {
+      E::CountSkippedPass();
+      continue;
     }
+    auto cnt = count[chunk].data();
+    auto dest = to->begin();
+    ForEachKey(from->cbegin(), from->cend(), [cnt, dest, chunk](auto it, auto key) {
+      dest[cnt[E::template KeyBin<Bits>(key, chunk)]++] = *it;
+    });
+    std::swap(from, to);
   }
+}
 
-  // Copy to the right place in the other array
-  if (T::value_type::NumChunks() > 1) {
-    auto chunk = T::value_type::NumChunks() - 2;
-    for (auto it = data.cbegin(); it != data.cend(); ++it) {
-      auto bin = it->GetBin(chunk);
-      other[count[chunk][bin]++] = *it;
-    }
-  }
+// Stable, Not In-Place, 2 Threads
+template <unsigned Bits = 16, typename T>
+void DualCountingRadixSort(T& data) noexcept {
+  CountingRadixSort<Bits>(data, 2);
+}
 
-  // Copy back to the right place in the data array
-  auto chunk = T::value_type::NumChunks() - 1;
-  for (auto it = other.cbegin(); it != other.cend(); ++it) {
-    auto bin = it->GetBin(chunk);
-    data[count[chunk][bin]++] = *it;
-  }
+// Stable, Not In-Place, 4 Threads
+template <unsigned Bits = 16, typename T>
+void QuadCountingRadixSort(T& data) noexcept {
+  CountingRadixSort<Bits>(data, 4);
+}
+
+// Stable, Not In-Place, 8 Threads
+template <unsigned Bits = 16, typename T>
+void OctoCountingRadixSort(T& data) noexcept {
+  CountingRadixSort<Bits>(data, 8);
+}
+
+// Stable, Not In-Place, One Thread Per Core
+template <unsigned Bits = 16, typename T>
+void AllCoresCountingRadixSort(T& data) noexcept {
+  CountingRadixSort<Bits>(data, std::max(1U, std::thread::hardware_concurrency()));
 }
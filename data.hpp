@@ -21,57 +21,90 @@
 
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
 #include <mutex>
 #include <type_traits>
 #include <utility>
 
 #include "color.hpp"
 
+// Element types that aren't arithmetic can describe their own keys, with a Key type, KeyBits()
+// and GetKey(), as Composite does (see composite.hpp).
 template <typename T>
+concept DescribesKey = requires(const T& value) {
+  typename T::Key;
+  T::KeyBits();
+  value.GetKey();
+};
+
+// Smallest unsigned integer type that can hold all the significant bits of T.
+template <typename T>
+struct KeyFor {
+  using type = std::conditional_t<
+      sizeof(T) <= 2,
+      uint16_t,
+      std::conditional_t<
+          sizeof(T) <= 4,
+          uint32_t,
+          std::conditional_t<sizeof(T) <= 8, uint64_t, unsigned __int128>>>;
+};
+template <DescribesKey T>
+struct KeyFor<T> {
+  using type = typename T::Key;
+};
+
+// Wrapper for the element type being sorted, which counts every operation done to it.  With
+// Counted = false, all counting is compiled out, to measure the real speed of each algorithm.
+template <typename T, bool Counted = true>
 class Data {
  public:
-  Data(const Data<T>& d) noexcept {
-    ++stats.constructions;
-    ++stats.copies;
+  Data(const Data& d) noexcept {
+    Count(&Stats::constructions);
+    Count(&Stats::copies);
     data = d.data;
   }
-  Data(Data<T>&& d) noexcept {
-    ++stats.constructions;
-    ++stats.moves;
+  Data(Data&& d) noexcept {
+    Count(&Stats::constructions);
+    Count(&Stats::moves);
     data = std::move(d.data);
   }
   Data(const T& d) noexcept {
-    ++stats.constructions;
-    ++stats.copies;
+    Count(&Stats::constructions);
+    Count(&Stats::copies);
     data = d;
   }
   Data(T&& d) noexcept {
-    ++stats.constructions;
-    ++stats.moves;
+    Count(&Stats::constructions);
+    Count(&Stats::moves);
     data = std::move(d);
   }
   ~Data() noexcept {
-    ++stats.destructions;
+    Count(&Stats::destructions);
   }
-  friend void swap(Data<T>& a, Data<T>& b) noexcept {
-    ++stats.swaps;
+  friend void swap(Data& a, Data& b) noexcept {
+    Count(&Stats::swaps);
     using std::swap;
     swap(a.data, b.data);
   }
-  void operator=(const Data<T>& d) noexcept {
-    ++stats.copies;
+  void operator=(const Data& d) noexcept {
+    Count(&Stats::copies);
     data = d.data;
   }
-  void operator=(Data<T>&& d) noexcept {
-    ++stats.moves;
+  void operator=(Data&& d) noexcept {
+    Count(&Stats::moves);
     data = std::move(d.data);
   }
-  bool operator<(const Data<T>& other) const noexcept {
-    ++stats.comparisons;
+  bool operator<(const Data& other) const noexcept {
+    Count(&Stats::comparisons);
     return data < other.data;
   }
-  bool operator==(const Data<T>& other) const noexcept {
-    ++stats.comparisons;
+  bool operator==(const Data& other) const noexcept {
+    Count(&Stats::comparisons);
     return data == other.data;
   }
 
@@ -87,14 +120,17 @@ class Data {
     //   Flush();
     // }
     void Flush() noexcept {
-      if (this != &(Data<T>::global_stats)) {
+      if (this != &(Data::global_stats)) {
         std::lock_guard<std::mutex> lock(stats_lock);
-        Data<T>::global_stats.comparisons += comparisons;
-        Data<T>::global_stats.copies += copies;
-        Data<T>::global_stats.moves += moves;
-        Data<T>::global_stats.swaps += swaps;
-        Data<T>::global_stats.constructions += constructions;
-        Data<T>::global_stats.destructions += destructions;
+        Data::global_stats.comparisons += comparisons;
+        Data::global_stats.copies += copies;
+        Data::global_stats.moves += moves;
+        Data::global_stats.swaps += swaps;
+        Data::global_stats.constructions += constructions;
+        Data::global_stats.destructions += destructions;
+        Data::global_stats.skipped_passes += skipped_passes;
+        Data::global_stats.split_ns += split_ns;
+        Data::global_stats.leaf_ns += leaf_ns;
 
         Clear();
       }
@@ -106,6 +142,9 @@ class Data {
       swaps = 0;
       constructions = 0;
       destructions = 0;
+      skipped_passes = 0;
+      split_ns = 0;
+      leaf_ns = 0;
     }
     unsigned long comparisons = 0;
     unsigned long copies = 0;
@@ -113,45 +152,108 @@ class Data {
     unsigned long swaps = 0;
     unsigned long constructions = 0;
     unsigned long destructions = 0;
+    unsigned long skipped_passes = 0; // Radix passes skipped because the digit never changes
+    unsigned long split_ns = 0; // Time spent splitting up the data for parallel sorts
+    unsigned long leaf_ns = 0; // Time spent sorting the pieces it was split into
   };
-  unsigned long GetBin(uint_fast8_t chunk) const noexcept {
-    ++stats.comparisons;
-    union {
-      T base_type;
-      uint16_t binary[NumChunks()];
-    } converter;
-    converter.base_type = data;
-    auto bin = converter.binary[chunk];
-    if (std::is_floating_point<T>()) {
-      if (chunk == NumChunks() - 1) {
-        if (bin & 0x8000) { // Negative
-          bin = 0x10000 - bin;
-        } else { // Positive
-          bin = 0x8000 + bin;
-        }
-      } else {
-        if (converter.binary[NumChunks() - 1] & 0x8000) { // Negative
-          bin ^= 0xFFFF;
-        }
-      }
-    } else if (std::is_signed<T>()) {
-      if (chunk == NumChunks() - 1) {
-        bin ^= 0x8000; // Proper order for MSW of 2's comp encoded number
-      }
+  using Key = typename KeyFor<T>::type;
+  constexpr static unsigned KeyBits() noexcept {
+    if constexpr (DescribesKey<T>) {
+      return T::KeyBits();
+    } else if (std::is_floating_point<T>() && std::numeric_limits<T>::digits == 64) {
+      return 80; // Unpad x87 extended precision long double
     }
-    return bin;
+    return sizeof(T) * 8;
   }
+  // The radix digits are Bits wide, numbered from the least significant (chunk 0) up.
+  template <unsigned Bits = 16>
+  unsigned long GetBin(uint_fast8_t chunk) const noexcept {
+    Count(&Stats::comparisons);
+    return KeyBin<Bits>(GetKey(), chunk);
+  }
+  // The digit for the given chunk of a key from GetKey() or GetKeys().
+  template <unsigned Bits = 16>
+  constexpr static unsigned long KeyBin(Key key, uint_fast8_t chunk) noexcept {
+    return static_cast<unsigned long>(key >> (chunk * Bits)) & (NumBins<Bits>() - 1);
+  }
+  template <unsigned Bits = 16>
   constexpr static unsigned long NumBins() noexcept {
-    return 0x10000UL;
+    return 1UL << Bits;
   }
+  template <unsigned Bits = 16>
   constexpr static uint_fast8_t NumChunks() noexcept {
-    constexpr auto ret = (sizeof(T) + 1) / 2;
-    if (std::is_floating_point<T>()) {
-      if (ret > 5) {
-        return 5; // Unpad long double (WARNING: Hard-Coded)
+    return (KeyBits() + Bits - 1) / Bits;
+  }
+
+  // Unsigned version of the data, which orders the same way the data does.
+  Key GetKey() const noexcept {
+    if constexpr (DescribesKey<T>) {
+      return data.GetKey();
+    } else {
+      return ScalarKey();
+    }
+  }
+  // GetKey() for count items in a row, in one batch, so the loop can be vectorized.  The loop is
+  // compiled for AVX2 and SSE4.2 as well as the baseline, and the best one this CPU supports is
+  // picked the first time it's used.  Counts a comparison per key, as GetBin() does per digit.
+  static void GetKeys(const Data* in, unsigned long count, Key* out) noexcept {
+    static const auto get_keys = PickGetKeys();
+    CountKeys(count);
+    get_keys(in, count, out);
+  }
+  static void CountKeys(unsigned long count) noexcept {
+    if constexpr (Counted) {
+      stats.comparisons += count;
+    }
+  }
+
+  // For strings: the 8 bytes from byte depth, as one big-endian word (zero past the end), so
+  // comparing the words of two strings compares them over those bytes, and each byte is a radix
+  // digit.  Counts a comparison, as GetBin() does.
+  uint64_t GetPrefix(unsigned long depth) const noexcept {
+    Count(&Stats::comparisons);
+    uint64_t word = 0;
+    if (depth + 8 <= data.size()) {
+      std::memcpy(&word, data.data() + depth, 8);
+    } else if (depth < data.size()) {
+      std::memcpy(&word, data.data() + depth, data.size() - depth);
+    }
+    if constexpr (std::endian::native == std::endian::little) {
+      word = __builtin_bswap64(word);
+    }
+    return word;
+  }
+  // For strings: the length, in bytes.
+  unsigned long Length() const noexcept {
+    return data.size();
+  }
+
+  // The splitmix64 finalizer, so every bit of the word affects every bit of the hash.
+  constexpr static uint64_t MixHash(uint64_t word) noexcept {
+    word = (word ^ (word >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    word = (word ^ (word >> 27)) * 0x94d049bb133111ebULL;
+    return word ^ (word >> 31);
+  }
+  // Hash of the value (of its key, or of the bytes of a string), for checking that a sort's output
+  // holds the same items as its input.  Not counted, as only those checks use it.
+  uint64_t Hash() const noexcept {
+    uint64_t hash = 0;
+    if constexpr (requires { data.data(); data.size(); }) {
+      for (unsigned long place = 0; place < data.size(); place += 8) {
+        uint64_t word = 0;
+        std::memcpy(&word, data.data() + place, std::min(8UL, data.size() - place));
+        hash = MixHash(hash + word);
+      }
+      hash = MixHash(hash + data.size());
+    } else {
+      Key key = GetKey();
+      uint64_t words[(sizeof(Key) + 7) / 8] = {};
+      std::memcpy(words, &key, sizeof(Key));
+      for (auto word : words) {
+        hash = MixHash(hash + word);
       }
     }
-    return ret;
+    return hash;
   }
 
   static Stats& GetStats() noexcept {
@@ -176,37 +278,122 @@ class Data {
   static unsigned long GetDestructions() noexcept {
     return stats.destructions;
   }
+  // Skipped passes are rare and cheap to count, so they are counted even without Counted.
+  static void CountSkippedPass() noexcept {
+    ++stats.skipped_passes;
+  }
+  // Times are summed over all threads, so they can be more than the time taken.
+  static void CountSplitTime(unsigned long ns) noexcept {
+    stats.split_ns += ns;
+  }
+  static void CountLeafTime(unsigned long ns) noexcept {
+    stats.leaf_ns += ns;
+  }
   static void ResetStats() noexcept {
     stats.Clear();
     global_stats.Clear();
   }
+  constexpr static bool IsCounted() noexcept {
+    return Counted;
+  }
 
  private:
+  // The key of an arithmetic T.
+  Key ScalarKey() const noexcept {
+    constexpr Key sign = Key(1) << (KeyBits() - 1);
+    Key key = 0;
+    std::memcpy(&key, &data, KeyBits() / 8);
+    if constexpr (std::is_floating_point<T>()) {
+      // Negative: Reverse order of magnitudes (flip all), Positive: Above all negatives (flip sign)
+      key ^= (Key(0) - (key >> (KeyBits() - 1))) | sign;
+      if constexpr (KeyBits() < sizeof(Key) * 8) {
+        key &= sign | (sign - 1);
+      }
+    } else if constexpr (std::is_signed<T>()) {
+      key ^= sign; // Proper order for MSB of 2's comp encoded number
+    }
+    return key;
+  }
+
+  using GetKeysFunc = void (*)(const Data*, unsigned long, Key*) noexcept;
+  static GetKeysFunc PickGetKeys() noexcept {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return GetKeysAVX2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+      return GetKeysSSE42;
+    }
+#endif
+    return GetKeysBaseline;
+  }
+  [[gnu::always_inline]] inline static void GetKeysLoop(
+      const Data* in, unsigned long count, Key* out) noexcept {
+    for (unsigned long item = 0; item < count; ++item) {
+      out[item] = in[item].GetKey();
+    }
+  }
+  static void GetKeysBaseline(const Data* in, unsigned long count, Key* out) noexcept {
+    GetKeysLoop(in, count, out);
+  }
+#if defined(__x86_64__)
+  [[gnu::target("avx2")]] static void GetKeysAVX2(
+      const Data* in, unsigned long count, Key* out) noexcept {
+    GetKeysLoop(in, count, out);
+  }
+  [[gnu::target("sse4.2")]] static void GetKeysSSE42(
+      const Data* in, unsigned long count, Key* out) noexcept {
+    GetKeysLoop(in, count, out);
+  }
+#endif
+
+  static void Count(unsigned long Stats::*counter) noexcept {
+    if constexpr (Counted) {
+      ++(stats.*counter);
+    }
+  }
+
   T data;
   static thread_local Stats stats;
   static Stats global_stats;
   static std::mutex stats_lock;
 };
 
-template <typename T>
-thread_local typename Data<T>::Stats Data<T>::stats;
+template <typename T, bool Counted>
+thread_local typename Data<T, Counted>::Stats Data<T, Counted>::stats;
 
-template <typename T>
-typename Data<T>::Stats Data<T>::global_stats;
+template <typename T, bool Counted>
+typename Data<T, Counted>::Stats Data<T, Counted>::global_stats;
 
-template <typename T>
-typename std::mutex Data<T>::stats_lock;
+template <typename T, bool Counted>
+typename std::mutex Data<T, Counted>::stats_lock;
+
+// Prints the counters from the stats (or anything else with the same fields).
+template <typename S>
+void ReportStats(const S& stats, bool counted) {
+  if (counted) {
+    printf("  " CBLU "%'15lu" CNRM " Comp ", stats.comparisons);
+    printf("  " CBLU "%'15lu" CNRM " Cnst ", stats.constructions);
+    printf("  " CBLU "%'15lu" CNRM " Dstr \n", stats.destructions);
+    printf("  " CBLU "%'15lu" CNRM " Swap ", stats.swaps);
+    printf("  " CBLU "%'15lu" CNRM " Copy ", stats.copies);
+    printf("  " CBLU "%'15lu" CNRM " Move \n", stats.moves);
+  } else {
+    printf("  " CYEL "(Uncounted)" CNRM "\n");
+  }
+  if (stats.skipped_passes > 0) {
+    printf("  " CBLU "%'15lu" CNRM " Skipped radix passes\n", stats.skipped_passes);
+  }
+  if (stats.split_ns > 0 || stats.leaf_ns > 0) {
+    printf("  " CBLU "%'15lu" CNRM " Split ns", stats.split_ns);
+    printf("  " CBLU "%'15lu" CNRM " Leaf ns (over all threads)\n", stats.leaf_ns);
+  }
+}
 
 template <typename T, typename V>
 void Report(const char* mes, T& data, V took) {
-  auto& stats = T::value_type::GetStats();
   printf("Took " CRED "%'15ldns" CNRM " for: " CGRN "%s" CNRM "\n", took.count(), mes);
-  printf("  " CBLU "%'15lu" CNRM " Comp ", stats.comparisons);
-  printf("  " CBLU "%'15lu" CNRM " Cnst ", stats.constructions);
-  printf("  " CBLU "%'15lu" CNRM " Dstr \n", stats.destructions);
-  printf("  " CBLU "%'15lu" CNRM " Swap ", stats.swaps);
-  printf("  " CBLU "%'15lu" CNRM " Copy ", stats.copies);
-  printf("  " CBLU "%'15lu" CNRM " Move \n", stats.moves);
+  ReportStats(T::value_type::GetStats(), T::value_type::IsCounted());
   T::value_type::ResetStats();
   using std::is_sorted;
   if (!is_sorted(data.cbegin(), data.cend())) {
@@ -215,6 +402,45 @@ void Report(const char* mes, T& data, V took) {
   printf("\n");
 }
 
+// Call func(it, key) for each item from begin to end (contiguous), with its key from GetKey(),
+// getting the keys in batches.
+template <typename Ti, typename F>
+void ForEachKey(Ti begin, Ti end, F func) noexcept {
+  using E = typename std::iterator_traits<Ti>::value_type;
+  constexpr unsigned long batch = 256;
+  typename E::Key keys[batch];
+  const unsigned long size = end - begin;
+  for (unsigned long done = 0; done < size; done += batch) {
+    const auto count = std::min(batch, size - done);
+    E::GetKeys(&*(begin + done), count, keys);
+    for (unsigned long item = 0; item < count; ++item) {
+      func(begin + done + item, keys[item]);
+    }
+  }
+}
+
+// Check whether the items from begin to end are in order already, or in reverse order (which is
+// then reversed, with each run of equal items turned back around, to keep it stable).  Each scan
+// stops at the first item out of its order, so on unordered input this costs a few comparisons.
+template <typename Ti>
+bool AlreadyOrdered(Ti begin, Ti end) noexcept {
+  if (std::is_sorted(begin, end)) {
+    return true;
+  } else if (!std::is_sorted(begin, end, [](const auto& a, const auto& b) { return b < a; })) {
+    return false;
+  }
+  std::reverse(begin, end);
+  for (auto run = begin; run != end;) {
+    auto run_end = run + 1;
+    while (run_end != end && !(*run < *run_end)) {
+      ++run_end;
+    }
+    std::reverse(run, run_end);
+    run = run_end;
+  }
+  return true;
+}
+
 template <typename T>
 auto is_sorted(T& in_data) noexcept {
   return std::is_sorted(in_data.begin(), in_data.end());
@@ -235,22 +461,3 @@ template <typename T>
 void stable_sort(T& in_data) noexcept {
   std::stable_sort(in_data.begin(), in_data.end());
 }
-
-#define RunCommon(in_data, func, mes, sdtype)                \
-  {                                                          \
-    etype::ResetStats();                                     \
-    auto start = std::chrono::high_resolution_clock::now();  \
-    func(in_data);                                           \
-    auto finish = std::chrono::high_resolution_clock::now(); \
-    Report(mes, in_data, finish - start);                    \
-  }
-#define Run(from_data, func, mes)          \
-  {                                        \
-    auto to_data = from_data;              \
-    RunCommon(to_data, func, mes, sdtype); \
-  }
-#define RunAs(from_data, func, mes, sdtype)             \
-  {                                                     \
-    sdtype to_data(from_data.begin(), from_data.end()); \
-    RunCommon(to_data, func, mes, sdtype);              \
-  }
@@ -19,7 +19,13 @@
 //
 // *************************************************************************
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <memory>
+#include <new>
+#include <utility>
+#include <vector>
 
 // This data_list class is a minimal implementation of a singly-linked list
 // for temporary us by sorting algorithms that require such a structure.
@@ -30,30 +36,86 @@ struct data_node {
   T value;
 };
 
+// Pool of nodes for a data_list, allocated in chunks which never move, and which are only freed
+// all together, with the pool.  Nodes allocated one after another come out next to each other.
+template <typename T>
+class data_pool {
+ public:
+  data_pool() = default;
+  data_pool(const data_pool&) = delete;
+  data_pool& operator=(const data_pool&) = delete;
+  ~data_pool() {
+    for (auto& chunk : chunks) {
+      for (unsigned long node = 0; node < chunk.used; ++node) {
+        chunk.nodes[node].value.~T();
+      }
+      ::operator delete(chunk.nodes);
+    }
+  }
+
+  void swap(data_pool& other) {
+    chunks.swap(other.chunks);
+  }
+  unsigned long size() const {
+    unsigned long total = 0;
+    for (auto& chunk : chunks) {
+      total += chunk.used;
+    }
+    return total;
+  }
+
+  // Make sure there is room for the next count nodes in the current chunk
+  void reserve(unsigned long count) {
+    if (chunks.empty() || chunks.back().capacity - chunks.back().used < count) {
+      auto nodes = static_cast<data_node<T>*>(
+          ::operator new(sizeof(data_node<T>) * count, std::nothrow));
+      if (nodes == nullptr) {
+        std::fflush(stdout);
+        std::fprintf(stderr, "\nERROR: data_list pool couldn't allocate %lu nodes\n", count);
+        std::abort();
+      }
+      chunks.push_back({nodes, 0, count});
+    }
+  }
+  template <typename... Args>
+  data_node<T>* allocate(data_node<T>* next, Args&&... args) {
+    if (chunks.empty() || chunks.back().used == chunks.back().capacity) {
+      reserve(std::max(1024UL, chunks.empty() ? 0 : chunks.back().capacity * 2));
+    }
+    auto node = chunks.back().nodes + chunks.back().used++;
+    node->next = next;
+    new (&node->value) T(std::forward<Args>(args)...);
+    return node;
+  }
+
+ private:
+  struct chunk_type {
+    data_node<T>* nodes;
+    unsigned long used;
+    unsigned long capacity;
+  };
+  std::vector<chunk_type> chunks;
+};
+
 template <typename T>
 class data_list {
  public:
   data_list() = default;
+  data_list(const data_list&) = delete;
+  data_list& operator=(const data_list&) = delete;
 
   template <typename Iter>
   data_list(Iter b, Iter e) {
     auto in_size = e - b;
     if (in_size > 0) {
-      memory = static_cast<data_node<T>*>(std::malloc(sizeof(data_node<T>) * in_size));
-      size = 0;
+      pool.reserve(in_size);
+      auto place = &head;
       for (auto it = b; it != e; ++it) {
-        memory[size].next = memory + size + 1;
-        memory[size].value = *it;
-        ++size;
+        place->next = pool.allocate(nullptr, *it);
+        place = place->next;
       }
-      head.next = memory;
-      memory[size - 1].next = nullptr;
     }
   }
-  ~data_list() {
-    if (memory != nullptr)
-      free(memory);
-  }
 
   bool empty() {
     return head.next == nullptr;
@@ -101,6 +163,8 @@ class data_list {
    private:
     data_node<T>* node;
   };
+  using const_iterator = iterator;
+
   data_list<T>::iterator before_begin() {
     return data_list<T>::iterator(&head);
   }
@@ -129,11 +193,29 @@ class data_list {
     mover->next = to.node->next;
     to.node->next = mover;
   }
+  void push_front(const T& value) {
+    head.next = pool.allocate(head.next, value);
+  }
+
+  // Rewrite the list into one sequential run of nodes, in list order, so that walking it (after
+  // sorting, say) steps forward through memory instead of chasing pointers all over.  The list
+  // must hold just the nodes from its own pool, all of them, as it does after being sorted.
+  void compact() {
+    data_pool<T> fresh;
+    if (pool.size() > 0) {
+      fresh.reserve(pool.size());
+    }
+    auto place = &head;
+    for (auto node = head.next; node != nullptr; node = node->next) {
+      place->next = fresh.allocate(nullptr, std::move(node->value));
+      place = place->next;
+    }
+    pool.swap(fresh);
+  }
 
  private:
   data_node<T> head = {nullptr, 0};
-  data_node<T>* memory = nullptr;
-  unsigned long size = 0;
+  data_pool<T> pool;
 
   // Forward-only seekless merge sort
   data_node<T>* merge_sort(data_node<T>* beg, data_node<T>* mid, unsigned long max) {
@@ -0,0 +1,6 @@
+main.o: main.cpp adaptive.hpp cbinsort.hpp cradixsort.hpp threadpool.hpp \
+ generate.hpp bench.hpp color.hpp data.hpp memstats.hpp perfcount.hpp \
+ verify.hpp composite.hpp datalist.hpp extsort.hpp binsort.hpp \
+ keyvalue.hpp mergesort.hpp radixsort.hpp samplesort.hpp select.hpp \
+ splitsort.hpp stringsort.hpp
+memstats.o: memstats.cpp memstats.hpp color.hpp
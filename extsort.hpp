@@ -0,0 +1,300 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "color.hpp"
+
+// External (larger than memory) sort of a raw binary file of fixed-width keys.  Each run that fits
+// in the memory budget is read, sorted with an in-memory sort, and spilled to an (already unlinked)
+// temporary file.  Then all runs are merged into the output file, with each run's next block read
+// ahead, and the output written behind, on their own threads while the merge goes on.
+
+// Prints the time and throughput of one phase of the external sort.
+template <typename V>
+void ReportPhase(const char* mes, unsigned long bytes, V took) {
+  auto secs = std::chrono::duration<double>(took).count();
+  printf("Took " CRED "%'15ldns" CNRM " for: " CGRN "%s" CNRM "\n", took.count(), mes);
+  printf("  " CBLU "%'15lu" CNRM " MB   ", bytes >> 20);
+  printf("  " CBLU "%'15.1f" CNRM " MB/s\n\n", (secs > 0.0) ? (bytes / secs / (1 << 20)) : 0.0);
+}
+
+// Reads one spilled run back in blocks, always having the next block on its way in.
+template <typename K>
+class RunReader {
+ public:
+  RunReader(FILE* in_file, unsigned long block_size) noexcept
+      : file(in_file), block(block_size), next(block_size) {
+    Fetch();
+    Advance();
+  }
+  RunReader(const RunReader&) = delete;
+  void operator=(const RunReader&) = delete;
+  ~RunReader() noexcept {
+    if (pending.valid()) {
+      pending.get();
+    }
+    fclose(file);
+  }
+
+  bool Empty() const noexcept {
+    return place == block.size();
+  }
+  const K& Front() const noexcept {
+    return block[place];
+  }
+  void Pop() noexcept {
+    if (++place == block.size()) {
+      Advance();
+    }
+  }
+
+ private:
+  void Fetch() noexcept {
+    next.resize(next.capacity());
+    pending = std::async(std::launch::async, [this]() {
+      next.resize(fread(next.data(), sizeof(K), next.size(), file));
+    });
+  }
+  void Advance() noexcept {
+    pending.get();
+    block.swap(next);
+    place = 0;
+    if (!block.empty()) {
+      Fetch();
+    }
+  }
+
+  FILE* file;
+  std::vector<K> block;
+  std::vector<K> next;
+  unsigned long place = 0;
+  std::future<void> pending;
+};
+
+// Writes blocks to a file, each one on its own thread while the next one is being filled.
+template <typename K>
+class BlockWriter {
+ public:
+  BlockWriter(FILE* out_file, unsigned long block_size) noexcept : file(out_file) {
+    block.reserve(block_size);
+    next.reserve(block_size);
+  }
+  BlockWriter(const BlockWriter&) = delete;
+  void operator=(const BlockWriter&) = delete;
+
+  void Push(const K& key) noexcept {
+    block.push_back(key);
+    if (block.size() == block.capacity()) {
+      Flush();
+    }
+  }
+  // Returns false if anything failed to write.
+  bool Finish() noexcept {
+    Flush();
+    if (pending.valid()) {
+      pending.get();
+    }
+    return ok;
+  }
+
+ private:
+  void Flush() noexcept {
+    if (pending.valid()) {
+      pending.get();
+    }
+    block.swap(next);
+    block.clear();
+    pending = std::async(std::launch::async, [this]() {
+      ok = ok && fwrite(next.data(), sizeof(K), next.size(), file) == next.size();
+    });
+  }
+
+  FILE* file;
+  std::vector<K> block;
+  std::vector<K> next;
+  bool ok = true;
+  std::future<void> pending;
+};
+
+// Whether there's nothing left in file, found by reading its next byte, and putting it back.
+inline bool AtEnd(FILE* file) noexcept {
+  int next = fgetc(file);
+  if (next == EOF) {
+    return true;
+  }
+  ungetc(next, file);
+  return false;
+}
+
+// Sort the keys (of type K, the type wrapped by the element type E) in the file named in, into the
+// file named out, using about memory bytes of memory, and temporary files in tmpdir.  The sorter
+// is the in-memory sort to use on a std::vector<E> for each run.  Returns false on failure.
+template <typename E, typename K, typename S>
+bool ExternalSort(
+    const char* in,
+    const char* out,
+    unsigned long memory,
+    const char* tmpdir,
+    S sorter) noexcept {
+  static_assert(sizeof(E) == sizeof(K), "Element type must be just the key");
+  FILE* in_file = fopen(in, "rb");
+  if (in_file == nullptr) {
+    perror(in);
+    return false;
+  }
+  FILE* out_file = fopen(out, "wb");
+  if (out_file == nullptr) {
+    perror(out);
+    fclose(in_file);
+    return false;
+  }
+
+  // Run formation: read, sort and spill one memory-sized run at a time
+  const unsigned long run_size = std::max(1UL, memory / sizeof(K));
+  const unsigned long io_size = std::min(run_size, (1UL << 20) / sizeof(K));
+  std::vector<FILE*> runs;
+  std::vector<K> block(io_size);
+  std::vector<E> run;
+  run.reserve(run_size);
+  unsigned long total = 0;
+  std::chrono::nanoseconds read_time(0), sort_time(0), spill_time(0);
+  bool ok = true;
+  for (;;) {
+    auto start = std::chrono::high_resolution_clock::now();
+    run.clear();
+    while (run.size() < run_size) {
+      const unsigned long want = std::min(io_size, run_size - run.size()) * sizeof(K);
+      auto got = fread(block.data(), 1, want, in_file);
+      run.insert(run.end(), block.begin(), block.begin() + got / sizeof(K));
+      if (got % sizeof(K) != 0) {
+        fprintf(stderr, "%s: Ends with %lu bytes of a partial key\n", in, got % sizeof(K));
+        ok = false;
+      }
+      if (got < want) {
+        break;
+      }
+    }
+    // If this run filled up, see if there's any more, as one full run still needs no merge
+    const bool last = run.size() < run_size || AtEnd(in_file);
+    if (ferror(in_file)) {
+      perror(in);
+      ok = false;
+    }
+    auto read = std::chrono::high_resolution_clock::now();
+    read_time += read - start;
+    if (run.empty() || !ok) {
+      break;
+    }
+    total += run.size();
+
+    sorter(run);
+    auto sorted = std::chrono::high_resolution_clock::now();
+    sort_time += sorted - read;
+
+    // A single run needs no merge: write it straight to the output
+    FILE* spill = out_file;
+    if (!runs.empty() || !last) {
+      std::string name = std::string(tmpdir) + "/sorting.XXXXXX";
+      int fd = mkstemp(name.data());
+      spill = (fd < 0) ? nullptr : fdopen(fd, "w+b");
+      if (spill == nullptr) {
+        perror(name.c_str());
+        ok = false;
+        break;
+      }
+      unlink(name.c_str());
+      runs.push_back(spill);
+    }
+    auto keys = reinterpret_cast<const K*>(run.data());
+    ok = fwrite(keys, sizeof(K), run.size(), spill) == run.size();
+    spill_time += std::chrono::high_resolution_clock::now() - sorted;
+    if (!ok) {
+      perror("Spilling run");
+      break;
+    } else if (last) {
+      break;
+    }
+  }
+  fclose(in_file);
+  run = std::vector<E>();
+  block = std::vector<K>();
+
+  ReportPhase("External sort: reading runs", total * sizeof(K), read_time);
+  ReportPhase("External sort: sorting runs", total * sizeof(K), sort_time);
+  ReportPhase("External sort: spilling runs", total * sizeof(K), spill_time);
+
+  if (!runs.empty() && ok) {
+    // Merge: k-way merge of all the runs, with two blocks per run and two for the output
+    auto start = std::chrono::high_resolution_clock::now();
+    const unsigned long merge_block = std::max(4096UL, run_size / (2 * runs.size() + 2));
+    std::vector<std::unique_ptr<RunReader<K>>> readers;
+    for (auto spill : runs) {
+      rewind(spill);
+      readers.emplace_back(std::make_unique<RunReader<K>>(spill, merge_block));
+    }
+    BlockWriter<K> writer(out_file, merge_block);
+
+    auto later = [&readers](unsigned long a, unsigned long b) {
+      return readers[b]->Front() < readers[a]->Front();
+    };
+    std::priority_queue<unsigned long, std::vector<unsigned long>, decltype(later)> heads(later);
+    for (unsigned long reader = 0; reader < readers.size(); ++reader) {
+      if (!readers[reader]->Empty()) {
+        heads.push(reader);
+      }
+    }
+    while (!heads.empty()) {
+      auto reader = heads.top();
+      heads.pop();
+      writer.Push(readers[reader]->Front());
+      readers[reader]->Pop();
+      if (!readers[reader]->Empty()) {
+        heads.push(reader);
+      }
+    }
+    ok = writer.Finish();
+    readers.clear();
+    auto took = std::chrono::high_resolution_clock::now() - start;
+    ReportPhase("External sort: merging runs", total * sizeof(K), took);
+  } else {
+    for (auto spill : runs) {
+      fclose(spill);
+    }
+  }
+
+  if (fclose(out_file) != 0) {
+    perror(out);
+    ok = false;
+  }
+  return ok;
+}
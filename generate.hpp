@@ -0,0 +1,281 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Generators for the keys to sort, in a variety of distributions.  Each is named by a spec of the
+// form "name" or "name:param", and all of them are reproducible from the seed.
+//
+//   random          Uniform over all the bits of the type (half negated, for signed types)
+//   contiguous      1 to length, ascending (centered on zero for signed types)
+//   inverted        The same, descending
+//   sorted          Random, then sorted ascending
+//   reversed        Random, then sorted descending
+//   nearly:K        Random, sorted, then K random pairs swapped (default: 1% of length)
+//   organ           Contiguous, ascending to the middle, then descending again
+//   sawtooth:P      Contiguous ascending runs, each of length P (default: 1024)
+//   few:U           Random picks from only U unique random values (default: 16)
+//   zipf:S          Zipf distributed picks, with exponent S (default: 1.0) from random values
+//   gauss           Normal distribution around the middle of the type's range
+//   narrow:B        Random values of only B bits (default: 8)
+//   equal           Every key the same random value
+//
+// For strings (sorting.string), there are also random, contiguous (zero-padded decimal), inverted,
+// sorted, reversed, nearly, few and equal, with random strings of 1 to 32 letters and digits, and:
+//
+//   bytes:L         Any bytes at all (zeros too), 0 to L of them (default: 16)
+//   prefix:P        Random strings after one shared prefix, of P bytes (default: 64)
+//   url             URL-like: a few hosts, paths from a small vocabulary, and some query IDs
+
+// Random key, over all the bits of T (half negated, for signed T).
+template <typename T>
+T RandomKey(std::mt19937_64& gen, unsigned long count) noexcept {
+  unsigned long val = gen();
+  if (std::is_signed<T>() && (count & 1) != 0) {
+    T fval = val;
+    return -fval;
+  }
+  return static_cast<T>(val);
+}
+
+// Key for the given place in a contiguous run of length keys.
+template <typename T>
+T ContiguousKey(unsigned long count, unsigned long length) noexcept {
+  if (std::is_signed<T>()) {
+    T fval = count;
+    return fval - (length / 2 + 1);
+  }
+  return static_cast<T>(count);
+}
+
+// Fill keys with length keys as given by the spec.  Returns false if the spec names no generator.
+template <typename T>
+bool GenerateKeys(
+    std::vector<T>& keys,
+    const std::string& spec,
+    unsigned long length,
+    unsigned int seed) noexcept {
+  const auto colon = spec.find(':');
+  const auto name = spec.substr(0, colon);
+  auto param = [&spec, colon](double def) {
+    return (colon == std::string::npos) ? def : std::strtod(spec.c_str() + colon + 1, nullptr);
+  };
+
+  std::mt19937_64 gen(seed);
+  keys.clear();
+  keys.reserve(length);
+
+  if (name == "random" || name == "sorted" || name == "reversed" || name == "nearly") {
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(RandomKey<T>(gen, count));
+    }
+    if (name != "random") {
+      std::sort(keys.begin(), keys.end());
+    }
+    if (name == "reversed") {
+      std::reverse(keys.begin(), keys.end());
+    } else if (name == "nearly" && length > 1) {
+      unsigned long swaps = std::max(0.0, param(std::max(1UL, length / 100)));
+      std::uniform_int_distribution<unsigned long> place(0, length - 1);
+      for (unsigned long swap = 0; swap < swaps; ++swap) {
+        std::swap(keys[place(gen)], keys[place(gen)]);
+      }
+    }
+  } else if (name == "contiguous") {
+    for (unsigned long count = 1; count <= length; ++count) {
+      keys.emplace_back(ContiguousKey<T>(count, length));
+    }
+  } else if (name == "inverted") {
+    for (unsigned long count = length; count > 0; --count) {
+      keys.emplace_back(ContiguousKey<T>(count, length));
+    }
+  } else if (name == "organ") {
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(ContiguousKey<T>(std::min(count, length - 1 - count), length / 2));
+    }
+  } else if (name == "sawtooth") {
+    unsigned long period = std::max(1.0, param(1024));
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(ContiguousKey<T>(count % period, period));
+    }
+  } else if (name == "few" || name == "zipf") {
+    // Picks from a table of random values: uniformly for few, by a power law of rank for zipf
+    unsigned long unique = (name == "few") ? std::max(1.0, param(16))
+                                           : std::clamp(length, 1UL, 1UL << 20);
+    std::vector<T> values;
+    for (unsigned long value = 0; value < unique; ++value) {
+      values.emplace_back(RandomKey<T>(gen, value));
+    }
+    std::vector<double> weights(unique, 1.0);
+    if (name == "zipf") {
+      auto exponent = param(1.0);
+      for (unsigned long rank = 0; rank < unique; ++rank) {
+        weights[rank] = 1.0 / std::pow(rank + 1, exponent);
+      }
+    }
+    std::discrete_distribution<unsigned long> pick(weights.begin(), weights.end());
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(values[pick(gen)]);
+    }
+  } else if (name == "gauss") {
+    double mean = 0.0;
+    double deviation = 1.0;
+    if (!std::is_floating_point<T>()) {
+      double low = std::numeric_limits<T>::lowest();
+      double high = std::numeric_limits<T>::max();
+      mean = low / 2 + high / 2;
+      deviation = (high - low) / 16;
+    }
+    // Clamped to 7 deviations, to stay well inside the range of the integer types
+    std::normal_distribution<double> normal(mean, deviation);
+    for (unsigned long count = 0; count < length; ++count) {
+      auto val = std::clamp(normal(gen), mean - 7 * deviation, mean + 7 * deviation);
+      keys.emplace_back(static_cast<T>(val));
+    }
+  } else if (name == "narrow") {
+    unsigned long bits = std::clamp(param(8), 1.0, 64.0);
+    unsigned long mask = (bits < 64) ? (1UL << bits) - 1 : ~0UL;
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(static_cast<T>(gen() & mask));
+    }
+  } else if (name == "equal") {
+    keys.assign(length, RandomKey<T>(gen, 0));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Random string of min to max bytes, each picked from the alphabet.
+inline std::string RandomString(
+    std::mt19937_64& gen, unsigned long min, unsigned long max, const std::string& alphabet) {
+  std::string out(std::uniform_int_distribution<unsigned long>(min, max)(gen), '\0');
+  std::uniform_int_distribution<unsigned long> pick(0, alphabet.size() - 1);
+  for (auto& byte : out) {
+    byte = alphabet[pick(gen)];
+  }
+  return out;
+}
+
+// Fill keys with length strings as given by the spec.  Returns false if the spec names no
+// generator for strings.
+inline bool GenerateKeys(
+    std::vector<std::string>& keys,
+    const std::string& spec,
+    unsigned long length,
+    unsigned int seed) noexcept {
+  const auto colon = spec.find(':');
+  const auto name = spec.substr(0, colon);
+  auto param = [&spec, colon](double def) {
+    return (colon == std::string::npos) ? def : std::strtod(spec.c_str() + colon + 1, nullptr);
+  };
+
+  std::mt19937_64 gen(seed);
+  keys.clear();
+  keys.reserve(length);
+  const std::string alnum = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+  if (name == "random" || name == "sorted" || name == "reversed" || name == "nearly") {
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(RandomString(gen, 1, 32, alnum));
+    }
+    if (name != "random") {
+      std::sort(keys.begin(), keys.end());
+    }
+    if (name == "reversed") {
+      std::reverse(keys.begin(), keys.end());
+    } else if (name == "nearly" && length > 1) {
+      unsigned long swaps = std::max(0.0, param(std::max(1UL, length / 100)));
+      std::uniform_int_distribution<unsigned long> place(0, length - 1);
+      for (unsigned long swap = 0; swap < swaps; ++swap) {
+        std::swap(keys[place(gen)], keys[place(gen)]);
+      }
+    }
+  } else if (name == "contiguous" || name == "inverted") {
+    const auto width = std::to_string(length).size();
+    for (unsigned long count = 1; count <= length; ++count) {
+      auto digits = std::to_string((name == "contiguous") ? count : length + 1 - count);
+      keys.emplace_back(std::string(width - digits.size(), '0') + digits);
+    }
+  } else if (name == "bytes") {
+    std::string any(256, '\0');
+    for (unsigned long byte = 0; byte < any.size(); ++byte) {
+      any[byte] = static_cast<char>(byte);
+    }
+    unsigned long most = std::max(0.0, param(16));
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(RandomString(gen, 0, most, any));
+    }
+  } else if (name == "prefix") {
+    auto prefix = RandomString(gen, std::max(0.0, param(64)), std::max(0.0, param(64)), alnum);
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(prefix + RandomString(gen, 1, 16, alnum));
+    }
+  } else if (name == "url") {
+    // Most of each URL is shared with many others, as in a crawl or an access log
+    const std::string lower = "abcdefghijklmnopqrstuvwxyz";
+    std::vector<std::string> hosts;
+    for (auto host = 0; host < 16; ++host) {
+      hosts.push_back("https://www." + RandomString(gen, 4, 12, lower) + ".com");
+    }
+    std::vector<std::string> words;
+    for (auto word = 0; word < 256; ++word) {
+      words.push_back(RandomString(gen, 2, 10, lower));
+    }
+    std::uniform_int_distribution<unsigned long> host(0, hosts.size() - 1);
+    std::uniform_int_distribution<unsigned long> word(0, words.size() - 1);
+    std::uniform_int_distribution<unsigned long> depth(1, 4);
+    for (unsigned long count = 0; count < length; ++count) {
+      auto url = hosts[host(gen)];
+      for (auto level = depth(gen); level > 0; --level) {
+        url += "/" + words[word(gen)];
+      }
+      if (gen() & 1) {
+        url += "?id=" + std::to_string(gen() % 1000000);
+      }
+      keys.emplace_back(std::move(url));
+    }
+  } else if (name == "few") {
+    unsigned long unique = std::max(1.0, param(16));
+    std::vector<std::string> values;
+    for (unsigned long value = 0; value < unique; ++value) {
+      values.emplace_back(RandomString(gen, 1, 32, alnum));
+    }
+    std::uniform_int_distribution<unsigned long> pick(0, unique - 1);
+    for (unsigned long count = 0; count < length; ++count) {
+      keys.emplace_back(values[pick(gen)]);
+    }
+  } else if (name == "equal") {
+    keys.assign(length, RandomString(gen, 1, 32, alnum));
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,213 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A Record is a key (a Data<>) with a payload that just comes along for the ride.  It forwards the
+// radix and stats interface of its key, so every sort that takes Data<> elements also sorts
+// Records, by key.  With a uint32_t payload, it is the (key, index) pair used for argsorts.
+template <typename K, typename P>
+class Record {
+ public:
+  using Key = typename K::Key;
+
+  Record(const K& k, const P& p = P()) noexcept : key(k), payload(p) {}
+
+  friend void swap(Record& a, Record& b) noexcept {
+    using std::swap;
+    swap(a.key, b.key);
+    swap(a.payload, b.payload);
+  }
+  bool operator<(const Record& other) const noexcept {
+    return key < other.key;
+  }
+  bool operator==(const Record& other) const noexcept {
+    return key == other.key;
+  }
+
+  const K& GetKey() const noexcept {
+    return key;
+  }
+  const P& GetPayload() const noexcept {
+    return payload;
+  }
+  // Of the key and the bytes of the payload, so a payload that is dropped, duplicated, or moved to
+  // another key changes the hash.
+  uint64_t Hash() const noexcept {
+    uint64_t words[(sizeof(P) + 7) / 8] = {};
+    std::memcpy(words, &payload, sizeof(P));
+    uint64_t hash = key.Hash();
+    for (auto word : words) {
+      hash = K::MixHash(hash + word);
+    }
+    return hash;
+  }
+
+  template <unsigned Bits = 16>
+  unsigned long GetBin(uint_fast8_t chunk) const noexcept {
+    return key.template GetBin<Bits>(chunk);
+  }
+  template <unsigned Bits = 16>
+  constexpr static unsigned long KeyBin(Key key, uint_fast8_t chunk) noexcept {
+    return K::template KeyBin<Bits>(key, chunk);
+  }
+  template <unsigned Bits = 16>
+  constexpr static unsigned long NumBins() noexcept {
+    return K::template NumBins<Bits>();
+  }
+  // The keys of records aren't next to each other, so these aren't extracted in one vector loop.
+  static void GetKeys(const Record* in, unsigned long count, Key* out) noexcept {
+    K::CountKeys(count);
+    for (unsigned long item = 0; item < count; ++item) {
+      out[item] = in[item].key.GetKey();
+    }
+  }
+  template <unsigned Bits = 16>
+  constexpr static uint_fast8_t NumChunks() noexcept {
+    return K::template NumChunks<Bits>();
+  }
+
+  static auto& GetStats() noexcept {
+    return K::GetStats();
+  }
+  static void ResetStats() noexcept {
+    K::ResetStats();
+  }
+  static void CountSkippedPass() noexcept {
+    K::CountSkippedPass();
+  }
+  static void CountSplitTime(unsigned long ns) noexcept {
+    K::CountSplitTime(ns);
+  }
+  static void CountLeafTime(unsigned long ns) noexcept {
+    K::CountLeafTime(ns);
+  }
+  constexpr static bool IsCounted() noexcept {
+    return K::IsCounted();
+  }
+
+ private:
+  K key;
+  P payload;
+};
+
+// Payload of the given number of bytes, which is never looked at by the sorts.
+template <std::size_t Bytes>
+using Payload = std::array<char, Bytes>;
+
+// Returns the permutation that sorts the keys of data, found by sorting (key, 32-bit index) pairs
+// with the given sort.  Only works for up to 4G items, and aborts (loudly) if given more.
+template <typename T, typename F, typename S>
+std::vector<uint32_t> ArgSort(const T& data, F get_key, S sorter) noexcept {
+  using K = std::decay_t<decltype(get_key(data.front()))>;
+  if (data.size() > std::numeric_limits<uint32_t>::max()) {
+    std::fflush(stdout);
+    std::fprintf(stderr, "\nERROR: ArgSort of %lu items, past 32-bit indexes\n", data.size());
+    std::abort();
+  }
+  std::vector<Record<K, uint32_t>> tagged;
+  tagged.reserve(data.size());
+  for (uint32_t index = 0; index < data.size(); ++index) {
+    tagged.emplace_back(get_key(data[index]), index);
+  }
+  sorter(tagged);
+
+  std::vector<uint32_t> order;
+  order.reserve(tagged.size());
+  for (auto& tag : tagged) {
+    order.push_back(tag.GetPayload());
+  }
+  return order;
+}
+template <typename T, typename S>
+std::vector<uint32_t> ArgSort(const T& keys, S sorter) noexcept {
+  return ArgSort(keys, [](const auto& key) -> const auto& { return key; }, sorter);
+}
+
+// Put each item of data in the place given by order (as returned from ArgSort).  This is also how
+// to apply the same sort to a separate payload array that parallels the key array.
+template <typename T>
+void Gather(T& data, const std::vector<uint32_t>& order) noexcept {
+  T out;
+  out.reserve(order.size());
+  for (auto index : order) {
+    out.push_back(std::move(data[index]));
+  }
+  data.swap(out);
+}
+
+// Sort records by key with the given sort.  When a record is bigger than a (key, index) pair,
+// only the pairs are moved through the sort's passes, and each payload is gathered once at the end.
+template <typename T, typename S>
+void KeyIndexSort(T& records, S sorter) noexcept {
+  using K = std::decay_t<decltype(records.front().GetKey())>;
+  if constexpr (sizeof(typename T::value_type) <= sizeof(Record<K, uint32_t>)) {
+    sorter(records);
+  } else {
+    auto get_key = [](const auto& record) -> const auto& { return record.GetKey(); };
+    Gather(records, ArgSort(records, get_key, sorter));
+  }
+}
+
+template <typename T>
+void ArgCountingRadixSort(T& data) noexcept {
+  Gather(data, ArgSort(data, [](auto& tagged) { CountingRadixSort(tagged); }));
+}
+
+template <typename T>
+void KeyIndexCountingRadixSort(T& data) noexcept {
+  KeyIndexSort(data, [](auto& tagged) { CountingRadixSort(tagged); });
+}
+
+template <typename T>
+void KeyIndexOctoCountingRadixSort(T& data) noexcept {
+  KeyIndexSort(data, [](auto& tagged) { OctoCountingRadixSort(tagged); });
+}
+
+template <typename T>
+void KeyIndexStableCountingBinSort(T& data) noexcept {
+  KeyIndexSort(data, [](auto& tagged) { StableCountingBinSort(tagged); });
+}
+
+template <typename T>
+void KeyIndexInPlaceCountingBinSort(T& data) noexcept {
+  KeyIndexSort(data, [](auto& tagged) { InPlaceCountingBinSort(tagged); });
+}
+
+template <typename T>
+void KeyIndexOctoSort(T& data) noexcept {
+  KeyIndexSort(data, [](auto& tagged) { OctoSort(tagged); });
+}
+
+template <typename T>
+void KeyIndexSplitSort(T& data) noexcept {
+  KeyIndexSort(data, [](auto& tagged) { SplitSort(tagged); });
+}
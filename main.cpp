@@ -24,38 +24,453 @@
 #include <clocale>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <forward_list>
+#include <memory>
 #include <random>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 #include <getopt.h>
 
+#include "adaptive.hpp"
+#include "bench.hpp"
+#include "composite.hpp"
 #include "data.hpp"
 #include "datalist.hpp"
+#include "extsort.hpp"
+#include "generate.hpp"
 
 #include "binsort.hpp"
 #include "cbinsort.hpp"
 #include "cradixsort.hpp"
+#include "keyvalue.hpp"
 #include "mergesort.hpp"
 #include "radixsort.hpp"
+#include "samplesort.hpp"
+#include "select.hpp"
 #include "splitsort.hpp"
+#include "stringsort.hpp"
 
 unsigned int seed = 123456789;
-unsigned long length = (1024 * 1024);
+std::vector<unsigned long> lengths = {1024 * 1024};
+const char* calibration = "calibration.txt"; // Of the thresholds for Sort(), from -K
+SortThresholds sort_limits;
 
 #ifndef DATATYPE
 #define DATATYPE uint64_t
 #endif
+using std::string; // For sorting.string, built with DATATYPE=string
 using etype = Data<DATATYPE>;
-using dtype = std::vector<etype>;
+using utype = Data<DATATYPE, false>;
+
+#define STRINGIFY(x) #x
+#define TYPENAME(x) STRINGIFY(x)
+
+// Run the key/value sorts on the given keys, each with a payload of the given size.
+template <typename E, std::size_t Bytes>
+void RunRecords(const std::vector<DATATYPE>& keys, BenchConfig& config) {
+  if (!config.list) {
+    std::printf(CYEL "With %lu-byte payloads:" CNRM "\n\n", Bytes);
+  }
+  // Each payload starts with the index of its item, so the check can tell if any are mixed up
+  std::vector<Record<E, Payload<Bytes>>> unsorted;
+  unsorted.reserve(keys.size());
+  for (unsigned long item = 0; item < keys.size(); ++item) {
+    Payload<Bytes> payload = {};
+    std::memcpy(payload.data(), &item, std::min(sizeof(item), Bytes));
+    unsorted.emplace_back(keys[item], payload);
+  }
+  auto prefix = std::to_string(Bytes) + "-byte records: ";
+  Bench<Record<E, Payload<Bytes>>> bench(TYPENAME(DATATYPE), config, unsorted, prefix);
+
+  bench.Add("Built-in std::sort()", [](auto& d) { sort(d); });
+  bench.Add("CountingRadixSort", [](auto& d) { CountingRadixSort(d); });
+  bench.Add("CountingRadixSort (Key/Index)", [](auto& d) { KeyIndexCountingRadixSort(d); });
+  bench.Add("OctoCountingRadixSort", [](auto& d) { OctoCountingRadixSort(d); });
+  bench.Add(
+      "OctoCountingRadixSort (Key/Index)", [](auto& d) { KeyIndexOctoCountingRadixSort(d); });
+  bench.Add("CountingBinSort (Stable)", [](auto& d) { StableCountingBinSort(d); });
+  bench.Add(
+      "CountingBinSort (Stable, Key/Index)", [](auto& d) { KeyIndexStableCountingBinSort(d); });
+  bench.Add("CountingBinSort (In-Place)", [](auto& d) { InPlaceCountingBinSort(d); });
+  bench.Add(
+      "CountingBinSort (In-Place, Key/Index)",
+      [](auto& d) { KeyIndexInPlaceCountingBinSort(d); });
+  bench.Add("OctoSort", [](auto& d) { OctoSort(d); });
+  bench.Add("OctoSort (Key/Index)", [](auto& d) { KeyIndexOctoSort(d); });
+  bench.Add("SplitSort", [](auto& d) { SplitSort(d); });
+  bench.Add("OctoSampleSort", [](auto& d) { OctoSampleSort(d); });
+  bench.Add("SplitSort (Key/Index)", [](auto& d) { KeyIndexSplitSort(d); });
+}
+
+// Run the sorts that take composite keys on records of (tenant, timestamp, score), ordered by
+// tenant, then newest first, then by score, as many as there are keys.  With tenants > 1, the
+// tenants are drawn from that many, and with just one, the whole tenant field is constant.
+template <typename E>
+void RunComposite(unsigned long size, uint32_t tenants, BenchConfig& config) {
+  using Fields = Composite<Ascending<uint32_t>, Descending<int64_t>, Ascending<double>>;
+  using C = Data<Fields, E::IsCounted()>;
+  if (!config.list) {
+    std::printf(CYEL "With composite keys, from %u tenant(s):" CNRM "\n\n", tenants);
+  }
+  std::mt19937_64 rng(seed);
+  std::vector<C> unsorted;
+  unsorted.reserve(size);
+  for (unsigned long item = 0; item < size; ++item) {
+    auto tenant = static_cast<uint32_t>(rng() % tenants);
+    auto timestamp = static_cast<int64_t>(rng() % 1000000000) - 500000000;
+    auto score = static_cast<double>(static_cast<int64_t>(rng() % 2000001) - 1000000) / 1000.0;
+    unsorted.emplace_back(Fields(tenant, timestamp, score));
+  }
+  auto prefix =
+      "Composite (" + std::to_string(tenants) + ((tenants > 1) ? " tenants): " : " tenant): ");
+  Bench<C> bench("composite", config, unsorted, prefix);
+
+  bench.Add("Built-in std::sort()", [](auto& d) { sort(d); });
+  bench.Add("CountingRadixSort", [](auto& d) { CountingRadixSort(d); });
+  bench.Add("OctoCountingRadixSort", [](auto& d) { OctoCountingRadixSort(d); });
+  bench.Add("CountingBinSort (Stable)", [](auto& d) { StableCountingBinSort(d); });
+  bench.Add("CountingBinSort (In-Place)", [](auto& d) { InPlaceCountingBinSort(d); });
+  bench.Add("OctoCountingBinSort (In-Place)", [](auto& d) { OctoInPlaceCountingBinSort(d); });
+}
+
+// Add the selections (which only sort part of the data) to the bench, for a range of k, each
+// checked against the fully sorted input.
+template <typename E>
+void AddSelections(Bench<E>& bench, unsigned long size) {
+  using dtype = std::vector<E>;
+  auto is_nth = [&bench](unsigned long nth) {
+    return [&bench, nth](const dtype& d) {
+      auto& sorted = bench.Sorted();
+      if (d.size() != sorted.size() || nth >= d.size()) {
+        return d.size() == sorted.size();
+      }
+      return d[nth] == sorted[nth] &&
+          std::none_of(d.begin(), d.begin() + nth, [&d, nth](auto& x) { return d[nth] < x; }) &&
+          std::none_of(d.begin() + nth, d.end(), [&d, nth](auto& x) { return x < d[nth]; });
+    };
+  };
+  auto is_first = [&bench](unsigned long k, bool all) {
+    return [&bench, k, all](const dtype& d) {
+      auto& sorted = bench.Sorted();
+      return d.size() == (all ? sorted.size() : k) &&
+          std::equal(d.begin(), d.begin() + k, sorted.begin());
+    };
+  };
+
+  const auto median = size / 2;
+  bench.AddChecked(
+      "Built-in std::nth_element() (median)",
+      [median](auto& d) { std::nth_element(d.begin(), d.begin() + median, d.end()); },
+      is_nth(median));
+  bench.AddChecked(
+      "NthElement (median)", [median](auto& d) { NthElement(d, median); }, is_nth(median));
+  bench.AddChecked(
+      "OctoNthElement (median)", [median](auto& d) { OctoNthElement(d, median); }, is_nth(median));
+
+  for (auto [k, label] : {std::pair(size / 1000, "0.1%"), {size / 100, "1%"}, {size / 10, "10%"}}) {
+    auto with_k = std::string(" (k=") + label + ")";
+    bench.AddChecked(
+        "Built-in std::partial_sort()" + with_k,
+        [k](auto& d) { std::partial_sort(d.begin(), d.begin() + k, d.end()); },
+        is_first(k, true));
+    bench.AddChecked(
+        "PartialSort" + with_k, [k](auto& d) { PartialSort(d, k); }, is_first(k, true));
+    bench.AddChecked(
+        "OctoPartialSort" + with_k, [k](auto& d) { OctoPartialSort(d, k); }, is_first(k, true));
+
+    // TopK leaves its input alone, and returns the first k, which are kept (so neither they nor
+    // the input are destroyed in the timing) and then checked instead
+    auto kept = std::make_shared<std::vector<dtype>>();
+    auto is_kept = [kept, check = is_first(k, false)](const dtype&) {
+      bool ok = !kept->empty() && check(kept->back());
+      kept->clear();
+      return ok;
+    };
+    bench.AddChecked("TopK" + with_k, [k, kept](auto& d) { kept->push_back(TopK(d, k)); }, is_kept);
+    bench.AddChecked(
+        "OctoTopK" + with_k, [k, kept](auto& d) { kept->push_back(OctoTopK(d, k)); }, is_kept);
+  }
+}
+
+// Run every selected algorithm on the given keys, wrapped in element type E.
+template <typename E>
+void RunAll(const std::vector<DATATYPE>& keys, BenchConfig& config) {
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<E> unsorted(keys.begin(), keys.end());
+  Bench<E> bench(TYPENAME(DATATYPE), config, unsorted);
+  if (!config.list) {
+    auto& sorted = bench.Sorted();
+    auto finish = std::chrono::high_resolution_clock::now();
+    Report("Completing setup", sorted, finish - start);
+  }
+  using ftype = std::forward_list<E>;
+  using ltype = data_list<E>;
+
+  bench.Add(
+      "Built-in std::is_sorted()", [](auto& d) { bench_sink = is_sorted(d); }, Input::Sorted);
+
+  bench.Add("Built-in std::sort()", [](auto& d) { sort(d); });
+  bench.Add("Re-run of built-in std::sort()", [](auto& d) { sort(d); }, Input::Sorted);
+
+  bench.AddThreaded("Sort (Adaptive)", [&bench](auto& d, int t) {
+    bench.Note("Picked " + Sort(d, t, sort_limits).Describe());
+  });
+
+  bench.Add("Built-in std::stable_sort()", [](auto& d) { stable_sort(d); });
+  bench.Add(
+      "Re-run of built-in std::stable_sort()", [](auto& d) { stable_sort(d); }, Input::Sorted);
+
+  bench.Add("HeapSort", [](auto& d) { heap_sort(d); });
+  bench.Add("Re-run of HeapSort", [](auto& d) { heap_sort(d); }, Input::Sorted);
+
+  bench.Add("MergeSort", [](auto& d) { MergeSort(d); });
+  bench.Add("Re-run of MergeSort", [](auto& d) { MergeSort(d); }, Input::Sorted);
+  bench.Add("DualMergeSort", [](auto& d) { DualMergeSort(d); });
+  bench.Add("QuadMergeSort", [](auto& d) { QuadMergeSort(d); });
+  bench.Add("OctoMergeSort", [](auto& d) { OctoMergeSort(d); });
+  bench.Add("AllCoresMergeSort", [](auto& d) { AllCoresMergeSort(d); });
+  bench.Add("NaturalMergeSort", [](auto& d) { NaturalMergeSort(d); });
+  bench.Add("Re-run of NaturalMergeSort", [](auto& d) { NaturalMergeSort(d); }, Input::Sorted);
+
+  bench.template AddAs<ftype>("BinSort (forward_list)", [](auto& d) { BinSort(d); });
+  bench.template AddAs<ltype>("BinSort (data_list)", [](auto& d) { BinSort(d); });
+
+  bench.template AddAs<ftype>("RadixSort (forward_list)", [](auto& d) { RadixSort(d); });
+  bench.template AddAs<ltype>("RadixSort (data_list)", [](auto& d) { RadixSort(d); });
+  bench.template AddAs<ltype>("OctoRadixSort (data_list)", [](auto& d) { OctoRadixSort(d); });
+  bench.template AddThreadedAs<ltype>("RadixSort (data_list, Threaded)", [](auto& d, int t) {
+    RadixSort(d, t);
+  });
+  bench.template AddAs<ltype>("RadixSort (data_list, then compact)", [](auto& d) {
+    RadixSort(d);
+    d.compact();
+  });
+
+  // Walking a list after it's sorted, with the nodes left where the sort put them, and compacted
+  auto radix = [](ltype& d) { RadixSort(d); };
+  auto radix_compact = [](ltype& d) {
+    RadixSort(d);
+    d.compact();
+  };
+  auto traverse = [](ltype& d) { bench_sink = is_sorted(d.cbegin(), d.cend()); };
+  bench.template AddPrepared<ltype>("Traverse (data_list, after RadixSort)", radix, traverse);
+  bench.template AddPrepared<ltype>(
+      "Traverse (data_list, after RadixSort and compact)", radix_compact, traverse);
+  bench.template AddPrepared<ltype>("Re-run of RadixSort (data_list)", radix, radix);
+  bench.template AddPrepared<ltype>(
+      "Re-run of RadixSort (data_list, compacted)", radix_compact, radix);
+
+  bench.Add("DualSort", [](auto& d) { DualSort(d); });
+  bench.Add("QuadSort", [](auto& d) { QuadSort(d); });
+  bench.Add("OctoSort", [](auto& d) { OctoSort(d); });
+  bench.Add("SplitSort", [](auto& d) { SplitSort(d); });
+
+  bench.Add("DualSampleSort", [](auto& d) { DualSampleSort(d); });
+  bench.Add("QuadSampleSort", [](auto& d) { QuadSampleSort(d); });
+  bench.Add("OctoSampleSort", [](auto& d) { OctoSampleSort(d); });
+  bench.Add("AllCoresSampleSort", [](auto& d) { AllCoresSampleSort(d); });
+
+  bench.Add("CountingRadixSort", [](auto& d) { CountingRadixSort(d); });
+  bench.Add("Re-run of CountingRadixSort", [](auto& d) { CountingRadixSort(d); }, Input::Sorted);
+  bench.Add("DualCountingRadixSort", [](auto& d) { DualCountingRadixSort(d); });
+  bench.Add("QuadCountingRadixSort", [](auto& d) { QuadCountingRadixSort(d); });
+  bench.Add("OctoCountingRadixSort", [](auto& d) { OctoCountingRadixSort(d); });
+  bench.Add("AllCoresCountingRadixSort", [](auto& d) { AllCoresCountingRadixSort(d); });
+
+  bench.Add("CountingBinSort (Stable)", [](auto& d) { StableCountingBinSort(d); });
+  bench.Add("CountingBinSort (In-Place)", [](auto& d) { InPlaceCountingBinSort(d); });
+  bench.Add("DualCountingBinSort (Stable)", [](auto& d) { DualStableCountingBinSort(d); });
+  bench.Add("DualCountingBinSort (In-Place)", [](auto& d) { DualInPlaceCountingBinSort(d); });
+  bench.Add("QuadCountingBinSort (Stable)", [](auto& d) { QuadStableCountingBinSort(d); });
+  bench.Add("QuadCountingBinSort (In-Place)", [](auto& d) { QuadInPlaceCountingBinSort(d); });
+  bench.Add("OctoCountingBinSort (Stable)", [](auto& d) { OctoStableCountingBinSort(d); });
+  bench.Add("OctoCountingBinSort (In-Place)", [](auto& d) { OctoInPlaceCountingBinSort(d); });
+
+  // Swept over the thread counts given on the command line
+  bench.AddThreaded("MergeSort (Threaded)", [](auto& d, int t) { MergeSort(d, t); });
+  bench.AddThreaded("SampleSort (Threaded)", [](auto& d, int t) { SampleSort(d, t); });
+  bench.AddThreaded("CountingRadixSort (Threaded)", [](auto& d, int t) {
+    CountingRadixSort(d, t);
+  });
+  bench.AddThreaded("CountingBinSort (Stable, Threaded)", [](auto& d, int t) {
+    StableCountingBinSort(d, t);
+  });
+  bench.AddThreaded("CountingBinSort (In-Place, Threaded)", [](auto& d, int t) {
+    InPlaceCountingBinSort(d, t);
+  });
+
+  // Digit widths other than the default 16 bits
+  bench.Add("CountingRadixSort (8-bit)", [](auto& d) { CountingRadixSort<8>(d); });
+  bench.Add("CountingRadixSort (11-bit)", [](auto& d) { CountingRadixSort<11>(d); });
+  bench.Add("CountingRadixSort (12-bit)", [](auto& d) { CountingRadixSort<12>(d); });
+  bench.Add("CountingBinSort (Stable, 8-bit)", [](auto& d) { StableCountingBinSort<8>(d); });
+  bench.Add("CountingBinSort (Stable, 11-bit)", [](auto& d) { StableCountingBinSort<11>(d); });
+  bench.Add("CountingBinSort (Stable, 12-bit)", [](auto& d) { StableCountingBinSort<12>(d); });
+  bench.Add("CountingBinSort (In-Place, 8-bit)", [](auto& d) { InPlaceCountingBinSort<8>(d); });
+  bench.Add(
+      "CountingBinSort (In-Place, 11-bit)", [](auto& d) { InPlaceCountingBinSort<11>(d); });
+  bench.Add(
+      "CountingBinSort (In-Place, 12-bit)", [](auto& d) { InPlaceCountingBinSort<12>(d); });
+  bench.Add(
+      "OctoCountingBinSort (In-Place, 8-bit)", [](auto& d) { OctoInPlaceCountingBinSort<8>(d); });
+  bench.Add(
+      "OctoCountingBinSort (In-Place, 11-bit)",
+      [](auto& d) { OctoInPlaceCountingBinSort<11>(d); });
+  bench.Add(
+      "OctoCountingBinSort (In-Place, 12-bit)",
+      [](auto& d) { OctoInPlaceCountingBinSort<12>(d); });
+  bench.template AddAs<ltype>("RadixSort (data_list, 8-bit)", [](auto& d) { RadixSort<8>(d); });
+  bench.template AddAs<ltype>(
+      "RadixSort (data_list, 11-bit)", [](auto& d) { RadixSort<11>(d); });
+
+  bench.Add(
+      "ArgSort (CountingRadixSort, then Gather)", [](auto& d) { ArgCountingRadixSort(d); });
+
+  AddSelections(bench, unsorted.size());
+
+  RunRecords<E, 8>(keys, config);
+  RunRecords<E, 16>(keys, config);
+  RunRecords<E, 64>(keys, config);
+
+  RunComposite<E>(keys.size(), 16, config);
+  RunComposite<E>(keys.size(), 1, config);
+}
+
+// Run every selected algorithm that sorts strings on the given keys, wrapped in element type E.
+template <typename E>
+void RunStrings(const std::vector<DATATYPE>& keys, BenchConfig& config) {
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<E> unsorted(keys.begin(), keys.end());
+  Bench<E> bench(TYPENAME(DATATYPE), config, unsorted);
+  if (!config.list) {
+    auto& sorted = bench.Sorted();
+    auto finish = std::chrono::high_resolution_clock::now();
+    Report("Completing setup", sorted, finish - start);
+  }
+
+  bench.Add(
+      "Built-in std::is_sorted()", [](auto& d) { bench_sink = is_sorted(d); }, Input::Sorted);
+
+  bench.Add("Built-in std::sort()", [](auto& d) { sort(d); });
+  bench.Add("Re-run of built-in std::sort()", [](auto& d) { sort(d); }, Input::Sorted);
+  bench.Add("Built-in std::stable_sort()", [](auto& d) { stable_sort(d); });
+
+  bench.Add("MergeSort", [](auto& d) { MergeSort(d); });
+  bench.Add("OctoMergeSort", [](auto& d) { OctoMergeSort(d); });
+  bench.Add("NaturalMergeSort", [](auto& d) { NaturalMergeSort(d); });
+  bench.Add("OctoSort", [](auto& d) { OctoSort(d); });
+  bench.Add("SplitSort", [](auto& d) { SplitSort(d); });
+  bench.Add("OctoSampleSort", [](auto& d) { OctoSampleSort(d); });
+
+  bench.Add("MultikeyQuickSort", [](auto& d) { MultikeyQuickSort(d); });
+  bench.Add("StringRadixSort", [](auto& d) { StringRadixSort(d); });
+  bench.Add("Re-run of StringRadixSort", [](auto& d) { StringRadixSort(d); }, Input::Sorted);
+  bench.Add("DualStringRadixSort", [](auto& d) { DualStringRadixSort(d); });
+  bench.Add("QuadStringRadixSort", [](auto& d) { QuadStringRadixSort(d); });
+  bench.Add("OctoStringRadixSort", [](auto& d) { OctoStringRadixSort(d); });
+  bench.Add("AllCoresStringRadixSort", [](auto& d) { AllCoresStringRadixSort(d); });
+
+  // Swept over the thread counts given on the command line
+  bench.AddThreaded("MergeSort (Threaded)", [](auto& d, int t) { MergeSort(d, t); });
+  bench.AddThreaded("SampleSort (Threaded)", [](auto& d, int t) { SampleSort(d, t); });
+  bench.AddThreaded("StringRadixSort (Threaded)", [](auto& d, int t) { StringRadixSort(d, t); });
+}
+
+// Run every selected algorithm for the type of the keys, wrapped in element type E.
+template <typename E>
+void Run(const std::vector<DATATYPE>& keys, BenchConfig& config) {
+  if constexpr (std::is_same_v<DATATYPE, std::string>) {
+    RunStrings<E>(keys, config);
+  } else {
+    RunAll<E>(keys, config);
+  }
+}
+
+// Split a comma-separated list.
+std::vector<std::string> SplitList(const std::string& arg) {
+  std::vector<std::string> list;
+  for (std::string::size_type start = 0, end = 0; end != std::string::npos; start = end + 1) {
+    end = arg.find(',', start);
+    list.push_back(arg.substr(start, end - start));
+  }
+  return list;
+}
+
+// Parse a comma-separated list of numbers.
+template <typename N>
+std::vector<N> ParseList(const char* arg) {
+  std::vector<N> list;
+  char* end = nullptr;
+  for (auto item = arg; *item != '\0'; item = (*end == ',') ? end + 1 : end) {
+    list.push_back(std::strtoul(item, &end, 10));
+    if (end == item) {
+      break;
+    }
+  }
+  return list;
+}
+
+// Write the results to the named file with the given writer, if a file was named.
+template <typename W>
+bool WriteResults(const char* name, const std::vector<BenchResult>& results, W writer) {
+  if (name == nullptr) {
+    return true;
+  }
+  FILE* out = std::fopen(name, "w");
+  if (out == nullptr) {
+    perror(name);
+    return false;
+  }
+  writer(out, results);
+  if (std::fclose(out) != 0) {
+    perror(name);
+    return false;
+  }
+  return true;
+}
 
 int main(int argc, char** argv) {
   bool inverted = false;
   bool contiguous = false;
-  static option lopts[] = {{"size", 1, 0, 's'}, {0, 0, 0, 0}};
-  for (auto arg = '\0'; arg >= 0; arg = getopt_long(argc, argv, "cil:rs:", lopts, nullptr)) {
+  bool counted = true;
+  bool uncounted = false;
+  const char* external_in = nullptr;
+  const char* external_out = nullptr;
+  unsigned long memory = 1024;
+  unsigned long budget = 0; // MB of heap each run may use, beyond its input, if not zero
+  const char* tmpdir = (std::getenv("TMPDIR") != nullptr) ? std::getenv("TMPDIR") : "/tmp";
+  const char* csv = nullptr;
+  const char* json = nullptr;
+  BenchConfig config;
+  std::vector<std::string> distributions = {"random"};
+  bool calibrate = false;
+  static option lopts[] = {
+      {"size", 1, 0, 's'},
+      {"external", 1, 0, 'x'},
+      {"output", 1, 0, 'o'},
+      {"memory", 1, 0, 'M'},
+      {"tmpdir", 1, 0, 'T'},
+      {"algorithms", 1, 0, 'a'},
+      {"threads", 1, 0, 't'},
+      {"warmups", 1, 0, 'w'},
+      {"runs", 1, 0, 'n'},
+      {"csv", 1, 0, 'C'},
+      {"json", 1, 0, 'J'},
+      {"list", 0, 0, 'L'},
+      {"distribution", 1, 0, 'd'},
+      {"calibrate", 0, 0, 'K'},
+      {"perf", 0, 0, 'p'},
+      {"calibration", 1, 0, 'k'},
+      {"budget", 1, 0, 'm'},
+      {"heap", 0, 0, 'H'},
+      {0, 0, 0, 0}};
+  const char* sopts = "a:bC:cd:Hik:Kl:J:LM:m:n:o:prs:T:t:uw:x:";
+  for (auto arg = '\0'; arg >= 0; arg = getopt_long(argc, argv, sopts, lopts, nullptr)) {
     if (arg == 'l') {
-      length = std::strtoul(optarg, nullptr, 10);
+      lengths = ParseList<unsigned long>(optarg);
     } else if (arg == 'r') {
       std::random_device rd;
       seed = rd();
@@ -65,87 +480,144 @@ int main(int argc, char** argv) {
       contiguous = true;
     } else if (arg == 'i') {
       inverted = true;
+    } else if (arg == 'u') {
+      counted = false;
+      uncounted = true;
+    } else if (arg == 'b') {
+      counted = true;
+      uncounted = true;
+    } else if (arg == 'x') {
+      external_in = optarg;
+    } else if (arg == 'o') {
+      external_out = optarg;
+    } else if (arg == 'M') {
+      memory = std::strtoul(optarg, nullptr, 10);
+    } else if (arg == 'T') {
+      tmpdir = optarg;
+    } else if (arg == 'a') {
+      config.patterns = SplitList(optarg); // Globs of the names of the algorithms to run
+    } else if (arg == 't') {
+      config.threads = ParseList<int>(optarg);
+    } else if (arg == 'w') {
+      config.warmups = std::strtol(optarg, nullptr, 10);
+    } else if (arg == 'n') {
+      config.reps = std::max(1L, std::strtol(optarg, nullptr, 10));
+    } else if (arg == 'C') {
+      csv = optarg;
+    } else if (arg == 'J') {
+      json = optarg;
+    } else if (arg == 'd') {
+      distributions = SplitList(optarg);
+    } else if (arg == 'L') {
+      config.list = true;
+    } else if (arg == 'p') {
+      config.perf = true;
+    } else if (arg == 'K') {
+      calibrate = true;
+    } else if (arg == 'k') {
+      calibration = optarg;
+    } else if (arg == 'm') {
+      budget = std::strtoul(optarg, nullptr, 10);
+    } else if (arg == 'H') {
+      CountHeap(); // Counting every allocation slows down the threaded runs, so only on request
+    }
+  }
+  if (contiguous) {
+    distributions = {inverted ? "inverted" : "contiguous"};
+  }
+  for (auto& distribution : distributions) {
+    std::vector<DATATYPE> none;
+    if (!GenerateKeys(none, distribution, 0, seed)) {
+      std::fprintf(stderr, "Unknown distribution: %s (see generate.hpp)\n", distribution.c_str());
+      return 1;
     }
   }
+  if (config.threads.empty()) {
+    config.threads.push_back(ThreadPool::Get().Size());
+  }
 
   setlocale(LC_NUMERIC, "");
-  std::printf("Full run for data length: %'lu\n\n", length);
 
-  auto start = std::chrono::high_resolution_clock::now();
-  dtype unsorted;
-  unsorted.reserve(length);
-
-  if (contiguous && inverted) {
-    for (unsigned long count = length; count > 0; --count) {
-      if (std::is_signed<DATATYPE>()) {
-        DATATYPE fval = count;
-        unsorted.emplace_back(fval - (length / 2 + 1));
-      } else {
-        unsorted.emplace_back(count);
-      }
+  if (config.list) {
+    Run<etype>({}, config);
+    return 0;
+  }
+
+  if (config.perf) {
+    // Counters can be missing (as in most containers), so just go on without them
+    auto& perf = PerfCounters::Get();
+    if (!perf.Available()) {
+      std::printf("Hardware counters unavailable (%s)\n\n", perf.Error().c_str());
+      config.perf = false;
+    } else if (!perf.Error().empty()) {
+      std::printf("Some hardware counters unavailable (%s)\n\n", perf.Error().c_str());
     }
-  } else if (contiguous) {
-    for (unsigned long count = 1; count <= length; ++count) {
-      if (std::is_signed<DATATYPE>()) {
-        DATATYPE fval = count;
-        unsorted.emplace_back(fval - (length / 2 + 1));
-      } else {
-        unsorted.emplace_back(count);
-      }
+  }
+
+  if (budget > 0) {
+    // Runs that go over abort, so a kernel can't quietly need more memory than we have to give it
+    std::printf("Each run has a heap budget of %'lu MB\n\n", budget);
+    SetHeapBudget(budget << 20);
+  }
+
+  if constexpr (std::is_same_v<DATATYPE, std::string>) {
+    if (calibrate || external_in != nullptr) {
+      std::fprintf(stderr, "Calibration (-K) and external sorts (-x) need numeric keys\n");
+      return 1;
     }
   } else {
-    std::mt19937_64 gen(seed);
-    for (unsigned long count = 0; count < length; ++count) {
-      unsigned long val = gen();
-      if (std::is_signed<DATATYPE>() && (count & 1) != 0) {
-        DATATYPE fval = val;
-        unsorted.emplace_back(-fval);
-      } else {
-        unsorted.emplace_back(val);
+    if (calibrate) {
+      // Time the kernels Sort() picks from, and save the sizes where each starts to win
+      auto threads = config.threads.front();
+      std::printf("Calibrating Sort() for %s, on %d threads\n\n", TYPENAME(DATATYPE), threads);
+      sort_limits = Calibrate<DATATYPE, utype>(threads, seed);
+      std::printf("\nradix_min %'lu, ", sort_limits.radix_min);
+      std::printf("dup_radix_min %'lu, ", sort_limits.dup_radix_min);
+      std::printf("parallel_min %'lu, saved to %s\n", sort_limits.parallel_min, calibration);
+      return sort_limits.Save(calibration, TYPENAME(DATATYPE)) ? 0 : 1;
+    }
+    sort_limits.Load(calibration, TYPENAME(DATATYPE));
+
+    if (external_in != nullptr) {
+      // External sort of a raw binary file of keys, using at most about memory MB of RAM.
+      if (external_out == nullptr) {
+        std::fprintf(stderr, "External sort (-x) needs an output file (-o)\n");
+        return 1;
       }
+      std::printf("External sort of %s into %s, in %'lu MB\n\n", external_in, external_out, memory);
+      auto sorter = [](auto& run) { OctoInPlaceCountingBinSort(run); };
+      auto start = std::chrono::high_resolution_clock::now();
+      auto ok = ExternalSort<utype, DATATYPE>(
+          external_in, external_out, memory << 20, tmpdir, sorter);
+      auto finish = std::chrono::high_resolution_clock::now();
+      std::printf("External sort total: %'ldns\n", (finish - start).count());
+      return ok ? 0 : 1;
     }
   }
 
-  auto sorted = unsorted;
-  std::sort(sorted.begin(), sorted.end());
-
-  auto finish = std::chrono::high_resolution_clock::now();
-  Report("Completing setup", sorted, finish - start);
-
-  Run(sorted, is_sorted, "Built-in std::is_sorted()");
+  for (auto& distribution : distributions) {
+    config.distribution = distribution;
+    for (auto length : lengths) {
+      std::printf("Full run for data length: %'lu (%s)\n\n", length, distribution.c_str());
 
-  Run(unsorted, sort, "Built-in std::sort()");
-  Run(sorted, sort, "Re-run of built-in std::sort()");
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<DATATYPE> keys;
+      GenerateKeys(keys, distribution, length, seed);
+      auto finish = std::chrono::high_resolution_clock::now();
+      std::printf("Generated %'lu keys in %'ldns\n\n", keys.size(), (finish - start).count());
 
-  Run(unsorted, stable_sort, "Built-in std::stable_sort()");
-  Run(sorted, stable_sort, "Re-run of built-in std::stable_sort()");
-
-  Run(unsorted, heap_sort, "HeapSort");
-  Run(sorted, heap_sort, "Re-run of HeapSort");
-
-  Run(unsorted, MergeSort, "MergeSort");
-  Run(sorted, MergeSort, "Re-run of MergeSort");
-
-  RunAs(unsorted, BinSort, "BinSort (forward_list)", std::forward_list<etype>);
-  RunAs(unsorted, BinSort, "BinSort (data_list)", data_list<etype>);
-
-  RunAs(unsorted, RadixSort, "RadixSort (forward_list)", std::forward_list<etype>);
-  RunAs(unsorted, RadixSort, "RadixSort (data_list)", data_list<etype>);
-
-  Run(unsorted, DualSort, "DualSort");
-  Run(unsorted, QuadSort, "QuadSort");
-  Run(unsorted, OctoSort, "OctoSort");
-
-  Run(unsorted, CountingRadixSort, "CountingRadixSort");
-
-  Run(unsorted, StableCountingBinSort, "CountingBinSort (Stable)");
-  Run(unsorted, InPlaceCountingBinSort, "CountingBinSort (In-Place)");
-  Run(unsorted, DualStableCountingBinSort, "DualCountingBinSort (Stable)");
-  Run(unsorted, DualInPlaceCountingBinSort, "DualCountingBinSort (In-Place)");
-  Run(unsorted, QuadStableCountingBinSort, "QuadCountingBinSort (Stable)");
-  Run(unsorted, QuadInPlaceCountingBinSort, "QuadCountingBinSort (In-Place)");
-  Run(unsorted, OctoStableCountingBinSort, "OctoCountingBinSort (Stable)");
-  Run(unsorted, OctoInPlaceCountingBinSort, "OctoCountingBinSort (In-Place)");
+      if (counted) {
+        std::printf(CYEL "Counted run:" CNRM "\n\n");
+        Run<etype>(keys, config);
+      }
+      if (uncounted) {
+        std::printf(CYEL "Uncounted run:" CNRM "\n\n");
+        Run<utype>(keys, config);
+      }
+    }
+  }
 
-  return 0;
+  auto ok = WriteResults(csv, config.results, WriteCSV);
+  ok = WriteResults(json, config.results, WriteJSON) && ok;
+  return ok ? 0 : 1;
 }
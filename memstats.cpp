@@ -0,0 +1,222 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "memstats.hpp"
+
+// Allocations come from every thread of the pool, so the counts are relaxed atomics: only their
+// totals are read, once the run is over.  They're only counted at all when asked for, as every
+// allocation of every thread then hits them (in the timed part of the run), and each is on its
+// own cache line, so those threads at least don't also fight over the others.  Live bytes are
+// signed, as memory allocated before counting started can be freed after it.
+namespace {
+constexpr long no_limit = std::numeric_limits<long>::max();
+std::atomic<bool> counting;
+alignas(64) std::atomic<unsigned long> allocated;
+alignas(64) std::atomic<unsigned long> allocations;
+alignas(64) std::atomic<long> live;
+alignas(64) std::atomic<long> peak;
+alignas(64) std::atomic<long> limit = no_limit; // Live bytes at which to abort, if a budget is set
+unsigned long budget = 0;
+long baseline = 0;
+std::string running; // The entry being run
+rusage usage;
+bool rss_reset = false; // If the peak RSS was reset to the current RSS for this run
+
+[[noreturn]] void OverBudget(long now) noexcept {
+  limit.store(no_limit, std::memory_order_relaxed); // Reporting this may allocate
+  std::fflush(stdout);
+  std::fprintf(
+      stderr,
+      "\nERROR: %s went over its heap budget of %lu bytes (with %ld bytes live)\n",
+      running.c_str(),
+      budget,
+      now - baseline);
+  std::abort();
+}
+
+void* Allocate(std::size_t size, std::size_t align) noexcept {
+  size = (size > 0) ? size : 1;
+  void* ptr = nullptr;
+  while (true) {
+    if (align <= alignof(std::max_align_t)) {
+      ptr = std::malloc(size);
+    } else if (posix_memalign(&ptr, align, size) != 0) {
+      ptr = nullptr;
+    }
+    if (ptr != nullptr) {
+      break;
+    } else if (std::get_new_handler() == nullptr) {
+      return nullptr;
+    }
+    std::get_new_handler()();
+  }
+
+  if (!counting.load(std::memory_order_relaxed)) {
+    return ptr;
+  }
+  long bytes = malloc_usable_size(ptr);
+  allocated.fetch_add(bytes, std::memory_order_relaxed);
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  auto now = live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  auto top = peak.load(std::memory_order_relaxed);
+  while (now > top && !peak.compare_exchange_weak(top, now, std::memory_order_relaxed)) {
+  }
+  if (now > limit.load(std::memory_order_relaxed)) {
+    OverBudget(now);
+  }
+  return ptr;
+}
+
+void* AllocateOrThrow(std::size_t size, std::size_t align) {
+  auto ptr = Allocate(size, align);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void Release(void* ptr) noexcept {
+  if (ptr != nullptr) {
+    if (counting.load(std::memory_order_relaxed)) {
+      live.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    }
+    std::free(ptr);
+  }
+}
+} // namespace
+
+void StartMemoryStats(const std::string& entry) noexcept {
+  running = entry;
+  baseline = live.load(std::memory_order_relaxed);
+  allocated.store(0, std::memory_order_relaxed);
+  allocations.store(0, std::memory_order_relaxed);
+  peak.store(baseline, std::memory_order_relaxed);
+  limit.store((budget > 0) ? baseline + budget : no_limit, std::memory_order_relaxed);
+
+  // Reset the peak RSS to the current RSS (since Linux 4.0), so this run's peak can be seen
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  rss_reset = (fd >= 0 && write(fd, "5", 1) == 1);
+  if (fd >= 0) {
+    close(fd);
+  }
+  getrusage(RUSAGE_SELF, &usage);
+}
+
+MemoryStats StopMemoryStats() noexcept {
+  rusage now;
+  getrusage(RUSAGE_SELF, &now);
+  limit.store(no_limit, std::memory_order_relaxed);
+  MemoryStats stats;
+  stats.heap_counted = counting.load(std::memory_order_relaxed);
+  stats.allocated = allocated.load(std::memory_order_relaxed);
+  stats.allocations = allocations.load(std::memory_order_relaxed);
+  stats.peak_heap = peak.load(std::memory_order_relaxed) - baseline;
+  stats.page_faults = (now.ru_minflt + now.ru_majflt) - (usage.ru_minflt + usage.ru_majflt);
+  // Without the reset, this would only be how far the run went past the peak of any run before it
+  stats.peak_rss = rss_reset ? (now.ru_maxrss - usage.ru_maxrss) * 1024 : -1; // From KiB
+  return stats;
+}
+
+void CountHeap() noexcept {
+  counting.store(true, std::memory_order_relaxed);
+}
+
+void SetHeapBudget(unsigned long bytes) noexcept {
+  budget = bytes;
+  if (budget > 0) {
+    CountHeap();
+  }
+}
+
+// The replacements for every form of the global operator new and delete.
+void* operator new(std::size_t size) {
+  return AllocateOrThrow(size, 0);
+}
+void* operator new[](std::size_t size) {
+  return AllocateOrThrow(size, 0);
+}
+void* operator new(std::size_t size, std::align_val_t align) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(align));
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size, 0);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size, 0);
+}
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+  return Allocate(size, static_cast<std::size_t>(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+  return Allocate(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void* ptr) noexcept {
+  Release(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+  Release(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept {
+  Release(ptr);
+}
+void operator delete[](void* ptr, std::size_t) noexcept {
+  Release(ptr);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  Release(ptr);
+}
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  Release(ptr);
+}
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+  Release(ptr);
+}
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+  Release(ptr);
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  Release(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  Release(ptr);
+}
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+  Release(ptr);
+}
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+  Release(ptr);
+}
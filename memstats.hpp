@@ -0,0 +1,68 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "color.hpp"
+
+// What one benchmark run did with memory: the heap as seen by the counting global allocator (in
+// memstats.cpp), which every operator new and delete in the program goes through, and the
+// process as seen by getrusage, which also covers direct mallocs, mmaps and the stacks.
+struct MemoryStats {
+  bool heap_counted = false; // If not, the heap numbers are all zero, as they weren't counted
+  unsigned long allocated = 0; // Bytes, counted as the allocator actually gave them
+  unsigned long allocations = 0;
+  unsigned long peak_heap = 0; // Bytes live at once, beyond what was live at the start
+  long page_faults = 0; // Minor and major
+  long peak_rss = 0; // Bytes the peak resident set grew by, or -1 if that can't be seen
+};
+
+// Start counting, for the run of the named entry.  With a budget set, the run aborts (loudly) as
+// soon as its live heap grows by more than that.
+void StartMemoryStats(const std::string& entry) noexcept;
+MemoryStats StopMemoryStats() noexcept;
+
+// Count the heap in each run after this.  Not done unless asked for, as it slows down every
+// allocation, in every thread.
+void CountHeap() noexcept;
+
+// The budget, in bytes, for each run after this.  Zero for none.  A budget counts the heap.
+void SetHeapBudget(unsigned long bytes) noexcept;
+
+// Prints what a run did with memory, with sizes in bytes.
+inline void ReportMemory(const MemoryStats& memory) noexcept {
+  if (memory.heap_counted) {
+    printf("  " CBLU "%'15lu" CNRM " Allocated  ", memory.allocated);
+    printf("  " CBLU "%'15lu" CNRM " Allocs     ", memory.allocations);
+    printf("  " CBLU "%'15lu" CNRM " Peak heap\n", memory.peak_heap);
+  } else {
+    printf("  %15s Allocated    %15s Allocs       %15s Peak heap\n", "-", "-", "-");
+  }
+  printf("  " CBLU "%'15ld" CNRM " Faults     ", memory.page_faults);
+  if (memory.peak_rss >= 0) {
+    printf("  " CBLU "%'15ld" CNRM " Peak RSS grew\n", memory.peak_rss);
+  } else {
+    printf("  %15s Peak RSS grew\n", "-");
+  }
+}
@@ -20,17 +20,283 @@
 // *************************************************************************
 
 #include <algorithm>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "threadpool.hpp"
+
+// Stable merge sort, with a single scratch buffer the size of the data, which each level of the
+// recursion alternates with the data, so no merge needs its own buffer.  Leaves are insertion
+// sorted.  With threads, the halves are sorted at the same time, and each merge is split into a
+// piece per thread, with each piece taking the items that co-ranking says end up in it.
 
 template <typename Ti>
-void MergeSort(Ti first, Ti last, bool wait = true) noexcept {
-  if (last - first > 1) {
-    Ti middle = first + (last - first) / 2;
-    MergeSort(first, middle);
-    MergeSort(middle, last);
-    std::inplace_merge(first, middle, last);
+void InsertionSort(Ti first, Ti last) noexcept {
+  if (last - first < 2) {
+    return;
+  }
+  for (auto it = first + 1; it < last; ++it) {
+    if (*it < *(it - 1)) {
+      auto temp = std::move(*it);
+      auto hole = it;
+      do {
+        *hole = std::move(*(hole - 1));
+        --hole;
+      } while (hole != first && temp < *(hole - 1));
+      *hole = std::move(temp);
+    }
+  }
+}
+
+// How many of the first place items of the merge of a and b come from a (equal items from a first).
+template <typename Ta, typename Tb>
+long CoRank(long place, Ta a, long a_size, Tb b, long b_size) noexcept {
+  long low = std::max(0L, place - b_size);
+  long high = std::min(place, a_size);
+  while (low < high) {
+    long from_a = (low + high) / 2;
+    long from_b = place - from_a;
+    if (from_b > 0 && !(b[from_b - 1] < a[from_a])) {
+      low = from_a + 1; // a[from_a] comes before b[from_b - 1], so it's in there too
+    } else {
+      high = from_a;
+    }
   }
+  return low;
 }
+
+// Merge (moving) a and b into out, splitting the output into a piece for each thread.
+template <typename Ta, typename Tb, typename To>
+void ParallelMerge(Ta a, long a_size, Tb b, long b_size, To out, int threads) noexcept {
+  const long size = a_size + b_size;
+  const int pieces = (size < 0x4000) ? 1 : std::max(1, threads);
+  // All the pieces are co-ranked first, as the merges leave moved-from items behind them
+  std::vector<long> from_a(pieces + 1);
+  for (auto piece = 0; piece <= pieces; ++piece) {
+    from_a[piece] = CoRank(size * piece / pieces, a, a_size, b, b_size);
+  }
+  auto merge = [a, b, out, size, pieces, &from_a](int piece) {
+    const long first = size * piece / pieces;
+    const long last = size * (piece + 1) / pieces;
+    const long a_first = from_a[piece];
+    const long a_last = from_a[piece + 1];
+    std::merge(
+        std::make_move_iterator(a + a_first),
+        std::make_move_iterator(a + a_last),
+        std::make_move_iterator(b + (first - a_first)),
+        std::make_move_iterator(b + (last - a_last)),
+        out + first);
+  };
+  TaskGroup group;
+  for (auto piece = 1; piece < pieces; ++piece) {
+    group.Spawn([merge, piece, out]() {
+      merge(piece);
+      out->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  merge(0);
+  group.Wait();
+}
+
+// Sort size items of data, ending up in buffer if to_buffer, and in data if not.
+template <typename Ti, typename Tb>
+void MergeSortTo(Ti data, Tb buffer, long size, bool to_buffer, int threads) noexcept {
+  if (size <= 32) {
+    InsertionSort(data, data + size);
+    if (to_buffer) {
+      std::move(data, data + size, buffer);
+    }
+    return;
+  }
+
+  // Sort each half into the other array, then merge them back into this one
+  const long half = size / 2;
+  if (threads > 1 && size > 0x4000) {
+    TaskGroup group;
+    group.Spawn([data, buffer, half, to_buffer, threads]() {
+      MergeSortTo(data, buffer, half, !to_buffer, threads / 2);
+      data->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+    MergeSortTo(data + half, buffer + half, size - half, !to_buffer, threads - threads / 2);
+    group.Wait();
+  } else {
+    MergeSortTo(data, buffer, half, !to_buffer, 1);
+    MergeSortTo(data + half, buffer + half, size - half, !to_buffer, 1);
+  }
+  if (to_buffer) {
+    ParallelMerge(data, half, data + half, size - half, buffer, threads);
+  } else {
+    ParallelMerge(buffer, half, buffer + half, size - half, data, threads);
+  }
+}
+
+template <typename Ti>
+void MergeSort(Ti first, Ti last, int threads = 1) noexcept {
+  std::vector<typename std::iterator_traits<Ti>::value_type> buffer(first, last);
+  MergeSortTo(first, buffer.begin(), last - first, false, threads);
+}
+template <typename T>
+void MergeSort(T& data, int threads = 1) noexcept {
+  MergeSort(data.begin(), data.end(), threads);
+}
+
+// Stable, Not In-Place, 2 Threads
+template <typename T>
+void DualMergeSort(T& data) noexcept {
+  MergeSort(data, 2);
+}
+
+// Stable, Not In-Place, 4 Threads
+template <typename T>
+void QuadMergeSort(T& data) noexcept {
+  MergeSort(data, 4);
+}
+
+// Stable, Not In-Place, 8 Threads
+template <typename T>
+void OctoMergeSort(T& data) noexcept {
+  MergeSort(data, 8);
+}
+
+// Stable, Not In-Place, One Thread Per Core
+template <typename T>
+void AllCoresMergeSort(T& data) noexcept {
+  MergeSort(data, std::max(1U, std::thread::hardware_concurrency()));
+}
+
+// Natural merge sort, with the merge order of powersort: the input is split into the runs that
+// are already in it (strictly descending runs are reversed, and short runs are extended to 32
+// items by insertion sort), which are merged as a stack of runs, each merge chosen by the depth
+// of the boundary between two runs in a balanced tree over the whole input.  So sorted and
+// reversed input take one pass, and a few long runs take a few merges.
+
+// Find the end of the run that starts at first, and put it in order (if it's descending).
+template <typename Ti>
+Ti NextRun(Ti first, Ti last) noexcept {
+  auto end = first + 1;
+  if (end == last) {
+    return end;
+  } else if (*end < *first) {
+    do {
+      ++end;
+    } while (end != last && *end < *(end - 1));
+    std::reverse(first, end);
+  } else {
+    do {
+      ++end;
+    } while (end != last && !(*end < *(end - 1)));
+  }
+  if (end - first < 32 && end != last) {
+    end = (last - first > 32) ? first + 32 : last;
+    InsertionSort(first, end);
+  }
+  return end;
+}
+
+// Depth of the boundary between the runs [begin, mid) and [mid, end), in a perfectly balanced
+// merge tree over all size items: one more than the leading bits their midpoints share.
+inline int NodePower(
+    unsigned long begin,
+    unsigned long mid,
+    unsigned long end,
+    unsigned long size) noexcept {
+  unsigned __int128 left = begin + mid; // Twice the midpoints, to stay in integers
+  unsigned __int128 right = mid + end;
+  unsigned long a = (left << 62) / (2 * size);
+  unsigned long b = (right << 62) / (2 * size);
+  return __builtin_clzl(a ^ b) - 1;
+}
+
+// First place from first (up to last) where pred is false, given that it's true before that and
+// false after.  Galloping checks 1, 2, 4... items ahead, then searches the last step, so it takes
+// about 2 log(k) comparisons to skip k items.
+template <typename Ti, typename P>
+Ti Gallop(Ti first, Ti last, P pred) noexcept {
+  const long size = last - first;
+  long bound = 1;
+  while (bound <= size && pred(first[bound - 1])) {
+    bound *= 2;
+  }
+  return std::partition_point(first + bound / 2, first + std::min(bound - 1, size), pred);
+}
+
+// Merge the sorted runs [first, mid) and [mid, last), with the items already in place at each end
+// skipped, and galloping through either side once it wins 7 times in a row.
+template <typename Ti, typename B>
+void GallopMerge(Ti first, Ti mid, Ti last, B& buffer) noexcept {
+  first = Gallop(first, mid, [mid](const auto& item) { return !(*mid < item); });
+  last = Gallop(mid, last, [mid](const auto& item) { return item < *(mid - 1); });
+  if (first == mid || mid == last) {
+    return;
+  }
+
+  buffer.assign(std::make_move_iterator(first), std::make_move_iterator(mid));
+  auto a = buffer.begin();
+  auto b = mid;
+  auto out = first;
+  int a_wins = 0;
+  int b_wins = 0;
+  while (a != buffer.end() && b != last) {
+    if (*b < *a) {
+      *out++ = std::move(*b++);
+      a_wins = 0;
+      if (++b_wins >= 7 && b != last) {
+        auto to = Gallop(b, last, [&a](const auto& item) { return item < *a; });
+        out = std::move(b, to, out);
+        b = to;
+        b_wins = 0;
+      }
+    } else {
+      *out++ = std::move(*a++);
+      b_wins = 0;
+      if (++a_wins >= 7 && a != buffer.end()) {
+        auto to = Gallop(a, buffer.end(), [&b](const auto& item) { return !(*b < item); });
+        out = std::move(a, to, out);
+        a = to;
+        a_wins = 0;
+      }
+    }
+  }
+  std::move(a, buffer.end(), out);
+}
+
+template <typename Ti>
+void NaturalMergeSort(Ti first, Ti last) noexcept {
+  struct Run {
+    Ti first;
+    int power;
+  };
+  const unsigned long size = last - first;
+  if (size < 2) {
+    return;
+  }
+
+  std::vector<typename std::iterator_traits<Ti>::value_type> buffer;
+  std::vector<Run> stack;
+  auto run = first;
+  auto run_end = NextRun(first, last);
+  while (run_end != last) {
+    auto next_end = NextRun(run_end, last);
+    auto power = NodePower(run - first, run_end - first, next_end - first, size);
+    while (!stack.empty() && stack.back().power > power) {
+      GallopMerge(stack.back().first, run, run_end, buffer);
+      run = stack.back().first;
+      stack.pop_back();
+    }
+    stack.push_back({run, power});
+    run = run_end;
+    run_end = next_end;
+  }
+  while (!stack.empty()) {
+    GallopMerge(stack.back().first, run, last, buffer);
+    run = stack.back().first;
+    stack.pop_back();
+  }
+}
+
+// Stable, Not In-Place, 1 Thread
 template <typename T>
-void MergeSort(T& data, bool wait = true) noexcept {
-  MergeSort(data.begin(), data.end(), wait);
+void NaturalMergeSort(T& data) noexcept {
+  NaturalMergeSort(data.begin(), data.end());
 }
@@ -0,0 +1,192 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "color.hpp"
+#include "threadpool.hpp"
+
+// Hardware performance counters, read with perf_event_open, for the main thread and every worker
+// of the ThreadPool, so they cover all the work of a parallel sort.  Each counter is summed over
+// the threads, and scaled up if the kernel had to multiplex it.  A counter that can't be opened
+// (in a container, or on a CPU without it) just reads as -1, as do all of them off Linux.
+class PerfCounters {
+ public:
+  static constexpr int num_events = 6;
+  using Counts = std::array<long, num_events>;
+  constexpr static const char* names[num_events] = {
+      "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"};
+
+  // The counters, opened (for this thread and the pool's) the first time this is called.
+  static PerfCounters& Get() noexcept {
+    static PerfCounters counters;
+    return counters;
+  }
+
+  bool Available() const noexcept {
+    for (auto& event : fds) {
+      if (!event.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // Why the first counter that couldn't be opened wasn't, if any.
+  const std::string& Error() const noexcept {
+    return error;
+  }
+
+  void Start() noexcept {
+#ifdef __linux__
+    for (auto& event : fds) {
+      for (auto fd : event) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  Counts Stop() noexcept {
+    Counts counts;
+    counts.fill(-1);
+#ifdef __linux__
+    for (auto& event : fds) {
+      for (auto fd : event) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    for (int event = 0; event < num_events; ++event) {
+      for (auto fd : fds[event]) {
+        uint64_t value[3]; // The count, and the ns it was enabled, and running
+        if (read(fd, value, sizeof(value)) == sizeof(value)) {
+          double scale = (value[2] > 0) ? static_cast<double>(value[1]) / value[2] : 0.0;
+          counts[event] = std::max(0L, counts[event]) + static_cast<long>(value[0] * scale);
+        }
+      }
+    }
+#endif
+    return counts;
+  }
+
+  ~PerfCounters() noexcept {
+#ifdef __linux__
+    for (auto& event : fds) {
+      for (auto fd : event) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+ private:
+  PerfCounters() noexcept {
+#ifdef __linux__
+    std::vector<long> tids = {syscall(SYS_gettid)};
+    for (auto tid : ThreadPool::Get().ThreadIds()) {
+      tids.push_back(tid);
+    }
+    constexpr auto cache_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const std::array<std::pair<uint32_t, uint64_t>, num_events> configs = {{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_miss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cache_miss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    }};
+
+    for (int event = 0; event < num_events; ++event) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = configs[event].first;
+      attr.config = configs[event].second;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1; // Allowed with the default perf_event_paranoid
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      for (auto tid : tids) {
+        int fd = syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+        if (fd < 0) {
+          // Only count this event if it can be counted on every thread
+          if (error.empty()) {
+            error = std::string(names[event]) + ": " + std::strerror(errno);
+          }
+          for (auto opened : fds[event]) {
+            close(opened);
+          }
+          fds[event].clear();
+          break;
+        }
+        fds[event].push_back(fd);
+      }
+    }
+#else
+    error = "perf_event_open is only on Linux";
+#endif
+  }
+
+  std::array<std::vector<int>, num_events> fds;
+  std::string error;
+};
+
+// Prints the hardware counters that could be read, with instructions per cycle.
+inline void ReportHardware(const PerfCounters::Counts& counts) noexcept {
+  if (std::none_of(counts.begin(), counts.end(), [](long count) { return count >= 0; })) {
+    return;
+  }
+  constexpr const char* labels[PerfCounters::num_events] = {
+      "Cycles", "Instrs", "L1D miss", "LLC miss", "dTLB miss", "Branch miss"};
+  for (int event = 0; event < PerfCounters::num_events; ++event) {
+    if (counts[event] >= 0) {
+      printf("  " CBLU "%'15ld" CNRM " %-10s", counts[event], labels[event]);
+    } else {
+      printf("  %15s %-10s", "-", labels[event]);
+    }
+    if (event == 1) {
+      if (counts[0] > 0 && counts[1] >= 0) {
+        printf("  " CBLU "%15.2f" CNRM " IPC", static_cast<double>(counts[1]) / counts[0]);
+      }
+      printf("\n");
+    } else if (event == 4 || event == 5) {
+      printf("\n");
+    }
+  }
+}
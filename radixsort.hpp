@@ -19,60 +19,176 @@
 //
 // *************************************************************************
 
-template <typename T>
-void RadixSort(T& data) noexcept {
-  constexpr unsigned long num_bins = T::value_type::NumBins();
+#pragma once
 
-  T table[2][num_bins];
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
 
-  // Splice data into table[0] (or table[1] for odd-word types), radix step 1
+#include "binsort.hpp"
+#include "threadpool.hpp"
+
+// Stable LSD radix sort of a linked list, which moves the nodes from bin to bin, and never copies
+// the items.  Items are always appended to the tails of their bins, so every pass sweeps the bins
+// in the same direction.  With more than one thread, each pass splits the list (as swept from the
+// bins) into segments of about the same size, and each thread moves its own segment into its own
+// table of bins.  The next pass sweeps each bin of all of the tables, in thread order.
+template <unsigned Bits = 16, typename T>
+void RadixSort(T& data, int threads = 1) noexcept {
+  using I = typename T::const_iterator;
+  constexpr unsigned long num_bins = T::value_type::template NumBins<Bits>();
+  constexpr uint_fast8_t num_chunks = T::value_type::template NumChunks<Bits>();
+
+  // Note every 256th node on one walk, to find where to cut the list into segments for threads
+  std::vector<I> marks;
+  unsigned long size = 0;
+  if (threads > 1) {
+    for (auto it = data.cbegin(); it != data.cend(); ++it, ++size) {
+      if ((size & 0xFF) == 0) {
+        marks.push_back(it);
+      }
+    }
+    threads = std::min(static_cast<unsigned long>(threads), size / 0x4000);
+  }
+  threads = std::max(1, threads);
+
+  // Two sets of tables of bins, one table per thread, which are too big for the stack
+  const unsigned long num_lists = num_bins * threads;
+  auto lists = std::make_unique<T[]>(2 * num_lists);
+  std::vector<I> tails;
+  for (unsigned long list = 0; list < 2 * num_lists; ++list) {
+    tails.push_back(lists[list].cbefore_begin());
+  }
+  std::vector<unsigned long> counts((threads > 1) ? num_lists : 0);
+  auto count = [&counts](int thread) {
+    return counts.empty() ? nullptr : counts.data() + num_bins * thread;
+  };
+
+  // Radix step 1, from data into the first set of tables
   uint_fast8_t chunk = 0;
-  while (!data.empty()) {
-    auto to = data.cbefore_begin()->NumChunks() & 1;
-    auto it = data.cbefore_begin();
-    auto bin = next(it)->GetBin(chunk);
-    table[to][bin].splice_after(table[to][bin].cbefore_begin(), data, it);
+  auto to = lists.get();
+  auto to_tails = tails.data();
+  if (threads == 1) {
+    AppendToBins<Bits>(data, data.cbefore_begin(), data.cend(), to, to_tails, nullptr, chunk);
+  } else {
+    // Each thread takes the items after its cut, up to the next cut.  The first item of each cut
+    // is left in data (so no two threads touch the same node), and put at the front of its bin
+    // after.
+    std::vector<I> cuts = {data.cbefore_begin()};
+    for (auto thread = 1; thread < threads; ++thread) {
+      cuts.push_back(marks[size * thread / threads / 0x100]);
+    }
+    cuts.push_back(data.cend());
+    TaskGroup group;
+    for (auto thread = threads - 1; thread >= 0; --thread) {
+      auto task = [&data, &cuts, to, to_tails, count, thread, chunk]() {
+        auto table = to + num_bins * thread;
+        auto table_tails = to_tails + num_bins * thread;
+        auto stop = cuts[thread + 1];
+        AppendToBins<Bits>(data, cuts[thread], stop, table, table_tails, count(thread), chunk);
+        T::value_type::GetStats(); // Must manually force a stats flush before this task moves on.
+      };
+      if (thread > 0) {
+        group.Spawn(task);
+      } else {
+        task();
+      }
+    }
+    group.Wait();
+    for (auto thread = 1; thread < threads; ++thread) {
+      auto bin = data.cbegin()->template GetBin<Bits>(chunk);
+      auto& list = to[num_bins * thread + bin];
+      list.splice_after(list.cbefore_begin(), data, data.cbefore_begin());
+      if (to_tails[num_bins * thread + bin] == list.cbefore_begin()) {
+        to_tails[num_bins * thread + bin] = list.cbegin();
+      }
+      ++count(thread)[bin];
+    }
   }
 
-  // Splice for steps 2 through N within the table
-  ++chunk;
-  for (; chunk < data.cbefore_begin()->NumChunks(); ++chunk) {
-    auto to = chunk & 1;
-    auto from = to ^ 1;
-
-    // Splice even step (or odd for odd-word types) into table[1]
-    if ((data.cbefore_begin()->NumChunks() & 1) == 0 || chunk > 1) {
-      for (unsigned long frombin = num_bins; frombin > 0;) {
-        --frombin;
-        while (!table[from][frombin].empty()) {
-          auto it = table[from][frombin].cbefore_begin();
-          auto tobin = next(it)->GetBin(chunk);
-          table[to][tobin].splice_after(table[to][tobin].cbefore_begin(), table[from][frombin], it);
-        }
+  // Radix steps 2 through N, from one set of tables into the other
+  for (++chunk; chunk < num_chunks; ++chunk) {
+    auto from = to;
+    to = lists.get() + ((chunk & 1) ? num_lists : 0);
+    to_tails = tails.data() + ((chunk & 1) ? num_lists : 0);
+    for (unsigned long list = 0; list < num_lists; ++list) {
+      to_tails[list] = to[list].cbefore_begin();
+    }
+
+    if (threads == 1) {
+      for (unsigned long bin = 0; bin < num_bins; ++bin) {
+        auto& list = from[bin];
+        AppendToBins<Bits>(list, list.cbefore_begin(), list.cend(), to, to_tails, nullptr, chunk);
       }
-      ++chunk;
+      continue;
     }
 
-    // Splice odd step (or even for odd-word types) into table[0]
-    if (chunk < data.cbefore_begin()->NumChunks()) {
-      std::swap(to, from);
-      for (unsigned long frombin = 0; frombin < num_bins; ++frombin) {
-        while (!table[from][frombin].empty()) {
-          auto it = table[from][frombin].cbefore_begin();
-          auto tobin = next(it)->GetBin(chunk);
-          table[to][tobin].splice_after(table[to][tobin].cbefore_begin(), table[from][frombin], it);
+    // Split the lists, in the order swept (each bin, in thread order), by the items in them
+    std::vector<unsigned long> splits = {0};
+    unsigned long total = 0;
+    for (unsigned long place = 0; place < num_lists; ++place) {
+      total += counts[num_bins * (place % threads) + place / threads];
+      while (splits.size() < static_cast<unsigned long>(threads) &&
+             total >= size * splits.size() / threads) {
+        splits.push_back(place + 1);
+      }
+    }
+    while (splits.size() <= static_cast<unsigned long>(threads)) {
+      splits.push_back(num_lists);
+    }
+    std::fill(counts.begin(), counts.end(), 0);
+
+    TaskGroup group;
+    for (auto thread = threads - 1; thread >= 0; --thread) {
+      auto task = [from, to, to_tails, &splits, count, thread, threads, chunk]() {
+        auto table = to + num_bins * thread;
+        auto table_tails = to_tails + num_bins * thread;
+        for (auto place = splits[thread]; place < splits[thread + 1]; ++place) {
+          auto& list = from[num_bins * (place % threads) + place / threads];
+          auto first = list.cbefore_begin();
+          AppendToBins<Bits>(list, first, list.cend(), table, table_tails, count(thread), chunk);
         }
+        T::value_type::GetStats(); // Must manually force a stats flush before this task moves on.
+      };
+      if (thread > 0) {
+        group.Spawn(task);
+      } else {
+        task();
       }
     }
+    group.Wait();
   }
 
-  // Splice sorted data back out of table[0]
-  auto from = (chunk & 1) ^ 1;
+  // Splice sorted data back out of the last set of tables
   auto place = data.cbefore_begin();
   for (unsigned long bin = 0; bin < num_bins; ++bin) {
-    while (!table[from][bin].empty()) {
-      data.splice_after(place, table[from][bin], table[from][bin].cbefore_begin());
-      ++place;
+    for (auto thread = 0; thread < threads; ++thread) {
+      AppendAll(data, place, to[num_bins * thread + bin]);
     }
   }
 }
+
+// Stable, Not In-Place, 2 Threads
+template <unsigned Bits = 16, typename T>
+void DualRadixSort(T& data) noexcept {
+  RadixSort<Bits>(data, 2);
+}
+
+// Stable, Not In-Place, 4 Threads
+template <unsigned Bits = 16, typename T>
+void QuadRadixSort(T& data) noexcept {
+  RadixSort<Bits>(data, 4);
+}
+
+// Stable, Not In-Place, 8 Threads
+template <unsigned Bits = 16, typename T>
+void OctoRadixSort(T& data) noexcept {
+  RadixSort<Bits>(data, 8);
+}
+
+// Stable, Not In-Place, One Thread Per Core
+template <unsigned Bits = 16, typename T>
+void AllCoresRadixSort(T& data) noexcept {
+  RadixSort<Bits>(data, std::max(1U, std::thread::hardware_concurrency()));
+}
@@ -0,0 +1,195 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "threadpool.hpp"
+
+// Parallel sample sort, for any number of threads.  The splitters between the buckets (one per
+// thread, rounded up to a power of two) are picked evenly from a sorted random sample, which is
+// oversampled so the buckets come out about the same size.  Each thread classifies its own slice
+// by walking down a tree of the splitters without branching, then copies its slice out to the
+// buckets, and then each bucket is sorted, and copied back, as a task of its own.  If a key is
+// common enough to fill much of a bucket on its own (as when splitters are equal), each bucket
+// gets an equality bucket after it, for the items equal to its upper splitter, which need no
+// sorting (as in IPS4o).
+template <typename T>
+void SampleSort(T& data, int threads) noexcept {
+  using E = typename T::value_type;
+  const unsigned long size = data.size();
+  if (threads < 2 || size < 0x4000) {
+    std::sort(data.begin(), data.end());
+    return;
+  }
+
+  unsigned long num_buckets = 1;
+  unsigned int levels = 0;
+  while (num_buckets < static_cast<unsigned long>(threads)) {
+    num_buckets *= 2;
+    ++levels;
+  }
+
+  // Splitter tree: node 1 is the root, and node j has children 2j and 2j+1 (node 0 is unused)
+  constexpr unsigned long oversample = 32;
+  std::minstd_rand gen(size);
+  std::uniform_int_distribution<unsigned long> pick(0, size - 1);
+  std::vector<E> sample;
+  sample.reserve(num_buckets * oversample);
+  for (unsigned long item = 0; item < num_buckets * oversample; ++item) {
+    sample.push_back(data[pick(gen)]);
+  }
+  std::sort(sample.begin(), sample.end());
+  std::vector<E> tree;
+  tree.reserve(num_buckets);
+  tree.push_back(sample.front());
+  for (unsigned long node = 1; node < num_buckets; ++node) {
+    unsigned long level = 0;
+    while ((node >> (level + 1)) != 0) {
+      ++level;
+    }
+    auto place = 2 * (node - (1UL << level)) + 1;
+    tree.push_back(sample[place * (num_buckets >> (level + 1)) * oversample]);
+  }
+
+  // The upper splitter of each bucket but the last, in order, for the equality buckets.  These are
+  // used if any splitter is equal to the sample half a bucket below it, which is always so when
+  // adjacent splitters are equal, and also catches it with only one splitter (for 2 threads).
+  std::vector<E> upper;
+  upper.reserve(num_buckets - 1);
+  bool equal_buckets = false;
+  for (unsigned long bucket = 0; bucket + 1 < num_buckets; ++bucket) {
+    upper.push_back(sample[(bucket + 1) * oversample]);
+    auto below = sample[(bucket + 1) * oversample - oversample / 2];
+    equal_buckets = equal_buckets || !(below < upper[bucket]);
+  }
+  const unsigned long num_classes = equal_buckets ? 2 * num_buckets : num_buckets;
+
+  // Classify each thread's slice, and count how many items of the slice go in each bucket
+  const unsigned long step = (size + threads - 1) / threads;
+  std::vector<uint16_t> bucket_of(size);
+  std::vector<unsigned long> count(num_classes * threads);
+  TaskGroup group;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto first = std::min(size, step * thread);
+    auto last = std::min(size, step * (thread + 1));
+    auto cnt = count.begin() + num_classes * thread;
+    group.Spawn([&data, &tree, &upper, &bucket_of, first, last, cnt, levels, num_buckets,
+                 equal_buckets]() {
+      for (auto item = first; item < last; ++item) {
+        unsigned long node = 1;
+        for (unsigned int level = 0; level < levels; ++level) {
+          node = 2 * node + (tree[node] < data[item]);
+        }
+        auto bucket = node - num_buckets;
+        if (equal_buckets) {
+          // Not above the upper splitter, so not below it means equal to it
+          bucket = 2 * bucket + (bucket + 1 < num_buckets && !(data[item] < upper[bucket]));
+        }
+        bucket_of[item] = bucket;
+        ++cnt[bucket];
+      }
+      E::GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+
+  // Convert counts to offsets, with each thread's part of a bucket after the previous thread's
+  std::vector<unsigned long> bucket_offset(num_classes + 1);
+  unsigned long offset = 0;
+  for (unsigned long bucket = 0; bucket < num_classes; ++bucket) {
+    bucket_offset[bucket] = offset;
+    for (auto thread = 0; thread < threads; ++thread) {
+      auto next_offset = offset + count[num_classes * thread + bucket];
+      count[num_classes * thread + bucket] = offset;
+      offset = next_offset;
+    }
+  }
+  bucket_offset[num_classes] = size;
+
+  // Copy each thread's slice out to the buckets
+  auto other = data;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto first = std::min(size, step * thread);
+    auto last = std::min(size, step * (thread + 1));
+    auto cnt = count.begin() + num_classes * thread;
+    group.Spawn([&data, &other, &bucket_of, first, last, cnt]() {
+      for (auto item = first; item < last; ++item) {
+        other[cnt[bucket_of[item]]++] = data[item];
+      }
+      E::GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+
+  // Sort each bucket, and move it back.  Equality buckets are just moved back, in pieces of a
+  // thread's share, so one that holds most of the data is still spread over the threads.
+  for (unsigned long bucket = 0; bucket < num_classes; ++bucket) {
+    if (equal_buckets && bucket % 2 == 1) {
+      for (auto piece = bucket_offset[bucket]; piece < bucket_offset[bucket + 1]; piece += step) {
+        auto end = std::min(bucket_offset[bucket + 1], piece + step);
+        group.Spawn([&data, &other, piece, end]() {
+          std::move(other.begin() + piece, other.begin() + end, data.begin() + piece);
+          E::GetStats(); // Must manually force a stats flush before this task moves on.
+        });
+      }
+      continue;
+    }
+    auto first = other.begin() + bucket_offset[bucket];
+    auto last = other.begin() + bucket_offset[bucket + 1];
+    auto dest = data.begin() + bucket_offset[bucket];
+    group.Spawn([first, last, dest]() {
+      std::sort(first, last);
+      std::move(first, last, dest);
+      E::GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+}
+
+// Not Stable, Not In-Place, 2 Threads
+template <typename T>
+void DualSampleSort(T& data) noexcept {
+  SampleSort(data, 2);
+}
+
+// Not Stable, Not In-Place, 4 Threads
+template <typename T>
+void QuadSampleSort(T& data) noexcept {
+  SampleSort(data, 4);
+}
+
+// Not Stable, Not In-Place, 8 Threads
+template <typename T>
+void OctoSampleSort(T& data) noexcept {
+  SampleSort(data, 8);
+}
+
+// Not Stable, Not In-Place, One Thread Per Core
+template <typename T>
+void AllCoresSampleSort(T& data) noexcept {
+  SampleSort(data, std::max(1U, std::thread::hardware_concurrency()));
+}
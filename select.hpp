@@ -0,0 +1,284 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "cbinsort.hpp"
+#include "cradixsort.hpp"
+#include "threadpool.hpp"
+
+// Radix selection: the same counting passes as the counting bin sorts, but after each count the
+// items are only split into those before the bin holding the wanted item, those in it, and those
+// after it, and only that bin goes on to the next chunk.  The items before it are sorted only if a
+// partial sort wants them, and the ones after it are left as they are, unsorted.
+
+// Ranges with fewer items than this are finished by std::nth_element() or std::partial_sort().
+constexpr unsigned long radix_select_min = 0x400;
+
+// Put the item that belongs at nth there, with every item that belongs before it before it, and
+// every item that belongs after it after it.  If sort_to is not 0 (then it's nth + 1), also sort
+// the items before sort_to.  Works on the given chunk, then the lower chunks marked in varies.
+template <unsigned Bits, typename T>
+void RadixSelect(
+    T begin,
+    T end,
+    unsigned long nth,
+    unsigned long sort_to,
+    int threads,
+    uint_fast8_t chunk,
+    const bool* varies) noexcept {
+  using E = typename std::iterator_traits<T>::value_type;
+  const unsigned long size = end - begin;
+  if (size < radix_select_min) {
+    if (sort_to > 0) {
+      using std::partial_sort;
+      partial_sort(begin, begin + sort_to, end);
+    } else {
+      using std::nth_element;
+      nth_element(begin, begin + nth, end);
+    }
+    return;
+  }
+  if (size < 0x10000) {
+    threads = 1; // Not worth spreading over threads
+  }
+
+  std::array<unsigned long, E::template NumBins<Bits>()> count = {};
+  CountBins<Bits>(begin, end, chunk, threads, count);
+  const auto next_chunk = NextVaryingChunk(varies, chunk);
+  if (count[begin->template GetBin<Bits>(chunk)] == size) {
+    E::CountSkippedPass();
+    if (next_chunk >= 0) {
+      RadixSelect<Bits>(begin, end, nth, sort_to, threads, next_chunk, varies);
+    }
+    return;
+  }
+
+  // Find the bin holding nth, and move the items in the bins before it to the front, then those in
+  // it, leaving the rest after them, in whatever order
+  unsigned long bin = 0;
+  unsigned long first = 0;
+  for (; first + count[bin] <= nth; ++bin) {
+    first += count[bin];
+  }
+  const unsigned long last = first + count[bin];
+  auto in_bin = std::partition(begin, end, [chunk, bin](const auto& item) {
+    return item.template GetBin<Bits>(chunk) < bin;
+  });
+  std::partition(in_bin, end, [chunk, bin](const auto& item) {
+    return item.template GetBin<Bits>(chunk) == bin;
+  });
+
+  // Only the items before the bin are wanted sorted, and only if sort_to is set
+  if (sort_to > 0 && first < radix_select_min) {
+    using std::sort;
+    sort(begin, begin + first);
+  } else if (sort_to > 0) {
+    CountingBinSort<Bits>(begin, begin + first, true, threads, chunk, varies);
+  }
+  // With no lower chunk that varies, every key in the bin is the same, so it's done
+  if (next_chunk >= 0 && last - first > 1) {
+    RadixSelect<Bits>(
+        begin + first,
+        begin + last,
+        nth - first,
+        (sort_to > 0) ? sort_to - first : 0,
+        threads,
+        next_chunk,
+        varies);
+  }
+}
+
+// Find the chunks that vary anywhere in the data once, then select from the top one that does.
+template <unsigned Bits, typename T>
+void RadixSelect(T& data, unsigned long nth, unsigned long sort_to, int threads) noexcept {
+  auto varies = FindVaryingChunks<Bits>(data, threads);
+  for (auto chunk_varies : varies) {
+    if (!chunk_varies) {
+      T::value_type::CountSkippedPass();
+    }
+  }
+  auto chunk = NextVaryingChunk(varies.data(), varies.size());
+  if (chunk >= 0) {
+    RadixSelect<Bits>(data.begin(), data.end(), nth, sort_to, threads, chunk, varies.data());
+  }
+}
+
+// Like std::nth_element(): the item that belongs at nth ends up there, with the data partitioned
+// around it.  In-Place, Not Stable, Optionally Threaded
+template <unsigned Bits = 16, typename T>
+void NthElement(T& data, unsigned long nth, int threads = 1) noexcept {
+  if (nth < data.size()) {
+    RadixSelect<Bits>(data, nth, 0, threads);
+  }
+}
+
+// Like std::partial_sort(): the first k items of the sorted data end up sorted at the front, and
+// the rest are left after them in no particular order.  In-Place, Not Stable, Optionally Threaded
+template <unsigned Bits = 16, typename T>
+void PartialSort(T& data, unsigned long k, int threads = 1) noexcept {
+  k = std::min<unsigned long>(k, data.size());
+  if (k > 0) {
+    RadixSelect<Bits>(data, k - 1, k, threads);
+  }
+}
+
+// Copy the items of [begin, end) whose digit for the chunk is before bin to top, and those whose
+// digit is bin to next, in order, with each thread filtering its own slice.
+template <unsigned Bits, typename T, typename C>
+void FilterBins(
+    T begin, T end, uint_fast8_t chunk, unsigned long bin, int threads, C& top, C& next) noexcept {
+  using E = typename std::iterator_traits<T>::value_type;
+  auto filter = [chunk, bin](T first, T last, C& to_top, C& to_next) {
+    ForEachKey(first, last, [chunk, bin, &to_top, &to_next](auto it, auto key) {
+      auto item_bin = E::template KeyBin<Bits>(key, chunk);
+      if (item_bin < bin) {
+        to_top.push_back(*it);
+      } else if (item_bin == bin) {
+        to_next.push_back(*it);
+      }
+    });
+  };
+  if (threads < 2) {
+    filter(begin, end, top, next);
+    return;
+  }
+
+  const unsigned long size = end - begin;
+  const unsigned long step = (size + threads - 1) / threads;
+  std::vector<C> tops(threads);
+  std::vector<C> nexts(threads);
+  TaskGroup group;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto first = begin + std::min(size, step * thread);
+    auto last = begin + std::min(size, step * (thread + 1));
+    group.Spawn([first, last, filter, to_top = &tops[thread], to_next = &nexts[thread]]() {
+      filter(first, last, *to_top, *to_next);
+      first->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+  for (auto thread = 0; thread < threads; ++thread) {
+    top.insert(top.end(), tops[thread].begin(), tops[thread].end());
+    next.insert(next.end(), nexts[thread].begin(), nexts[thread].end());
+  }
+}
+
+// Returns the first k items of the sorted data, in order, without moving anything in data.  Each
+// pass counts the digits of the items still in the running, then copies out those in the bins
+// before the one where the k-th item falls, and keeps only the ones in that bin for the next pass,
+// so the whole of data is only read twice.  Not In-Place, Optionally Threaded
+template <unsigned Bits = 16, typename T>
+T TopK(const T& data, unsigned long k, int threads = 1) noexcept {
+  using E = typename T::value_type;
+  k = std::min<unsigned long>(k, data.size());
+  T top;
+  top.reserve(k);
+  auto varies = FindVaryingChunks<Bits>(data, threads);
+  auto chunk = NextVaryingChunk(varies.data(), varies.size());
+
+  // The items that might still be among the first k, which start as all of them
+  T next;
+  T candidates;
+  const T* from = &data;
+  while (chunk >= 0 && top.size() < k && from->size() >= radix_select_min) {
+    if (from->size() < 0x10000) {
+      threads = 1; // Not worth spreading over threads
+    }
+    std::array<unsigned long, E::template NumBins<Bits>()> count = {};
+    CountBins<Bits>(from->begin(), from->end(), chunk, threads, count);
+
+    // Find the bin where the k-th item falls
+    const unsigned long wanted = k - top.size();
+    unsigned long bin = 0;
+    unsigned long before = 0;
+    for (; before + count[bin] < wanted; ++bin) {
+      before += count[bin];
+    }
+    if (count[bin] == from->size()) {
+      E::CountSkippedPass();
+    } else {
+      next.clear();
+      FilterBins<Bits>(from->begin(), from->end(), chunk, bin, threads, top, next);
+      candidates.swap(next);
+      from = &candidates;
+    }
+    chunk = NextVaryingChunk(varies.data(), chunk);
+  }
+
+  // The rest come from the few candidates left (or ones with all the same key, if no chunk is)
+  const unsigned long wanted = k - top.size();
+  if (wanted > 0) {
+    T rest(from->begin(), from->end());
+    using std::nth_element;
+    nth_element(rest.begin(), rest.begin() + (wanted - 1), rest.end());
+    top.insert(top.end(), rest.begin(), rest.begin() + wanted);
+  }
+  if (top.size() < radix_select_min) {
+    using std::sort;
+    sort(top.begin(), top.end());
+  } else {
+    InPlaceCountingBinSort<Bits>(top, threads);
+  }
+  return top;
+}
+
+// In-Place, Not Stable, 8 Threads
+template <unsigned Bits = 16, typename T>
+void OctoNthElement(T& data, unsigned long nth) noexcept {
+  NthElement<Bits>(data, nth, 8);
+}
+
+// In-Place, Not Stable, One Thread Per Core
+template <unsigned Bits = 16, typename T>
+void AllCoresNthElement(T& data, unsigned long nth) noexcept {
+  NthElement<Bits>(data, nth, std::max(1U, std::thread::hardware_concurrency()));
+}
+
+// In-Place, Not Stable, 8 Threads
+template <unsigned Bits = 16, typename T>
+void OctoPartialSort(T& data, unsigned long k) noexcept {
+  PartialSort<Bits>(data, k, 8);
+}
+
+// In-Place, Not Stable, One Thread Per Core
+template <unsigned Bits = 16, typename T>
+void AllCoresPartialSort(T& data, unsigned long k) noexcept {
+  PartialSort<Bits>(data, k, std::max(1U, std::thread::hardware_concurrency()));
+}
+
+// Not In-Place, 8 Threads
+template <unsigned Bits = 16, typename T>
+T OctoTopK(const T& data, unsigned long k) noexcept {
+  return TopK<Bits>(data, k, 8);
+}
+
+// Not In-Place, One Thread Per Core
+template <unsigned Bits = 16, typename T>
+T AllCoresTopK(const T& data, unsigned long k) noexcept {
+  return TopK<Bits>(data, k, std::max(1U, std::thread::hardware_concurrency()));
+}
@@ -20,92 +20,220 @@
 // *************************************************************************
 
 #include <algorithm>
-#include <future>
+#include <chrono>
+#include <iterator>
+#include <optional>
+#include <utility>
 #include <vector>
 
-template <typename T>
-struct SplitSortFutureBox {
-  static thread_local std::vector<std::future<void>> futures;
-};
-template <typename T>
-thread_local std::vector<std::future<void>> SplitSortFutureBox<T>::futures;
+#include "threadpool.hpp"
 
-template <typename Ti>
-auto do_partition(Ti first, Ti last) noexcept {
-  if (last - first < 2)
-    return first;
-  const auto pivot = *(first + ((last - first) / 2));
-  return std::partition(first, last, [pivot](const auto& em) { return em < pivot; });
+// Count the time since start as time splitting (or as time leaf sorting) for the items at it.
+template <typename Ti, typename V>
+void CountTime(Ti it, bool leaf, V start) noexcept {
+  auto took = std::chrono::high_resolution_clock::now() - start;
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(took).count();
+  if (leaf) {
+    it->CountLeafTime(ns);
+  } else {
+    it->CountSplitTime(ns);
+  }
 }
 
-template <typename T>
-void WaitAll(T&) noexcept {
-  SplitSortFutureBox<typename T::value_type> future_box;
-  auto& futures = future_box.futures;
+// Partition with the given number of threads.  Each thread partitions its own block, then the
+// items left on the wrong side of the overall split point are swapped across it, with each thread
+// taking an equal share of those swaps.
+template <typename Ti, typename P>
+Ti ParallelPartition(Ti first, Ti last, P pred, int threads) noexcept {
+  const long size = last - first;
+  if (threads < 2 || size < 0x4000) {
+    auto start = std::chrono::high_resolution_clock::now();
+    auto mid = std::partition(first, last, pred);
+    CountTime(first, false, start);
+    return mid;
+  }
+
+  std::vector<long> mids(threads);
+  TaskGroup group;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto begin = first + size * thread / threads;
+    auto end = first + size * (thread + 1) / threads;
+    group.Spawn([first, begin, end, pred, mid = &mids[thread]]() {
+      auto start = std::chrono::high_resolution_clock::now();
+      *mid = std::partition(begin, end, pred) - first;
+      CountTime(begin, false, start);
+      begin->GetStats(); // Have to manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+
+  // Find the runs of items on the wrong side: high ones below the split, and low ones above it
+  long split = 0;
+  for (auto thread = 0; thread < threads; ++thread) {
+    split += mids[thread] - size * thread / threads;
+  }
+  std::vector<std::pair<long, long>> high_below;
+  std::vector<std::pair<long, long>> low_above;
+  long wrong = 0;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto begin = size * thread / threads;
+    auto end = size * (thread + 1) / threads;
+    if (mids[thread] < std::min(end, split)) {
+      high_below.emplace_back(mids[thread], std::min(end, split));
+      wrong += high_below.back().second - high_below.back().first;
+    }
+    if (std::max(begin, split) < mids[thread]) {
+      low_above.emplace_back(std::max(begin, split), mids[thread]);
+    }
+  }
 
-  for (auto& fut : futures) {
-    fut.get();
+  // Swap the n'th wrong high item with the n'th wrong low item, each thread taking its share of n
+  for (auto thread = 0; thread < threads; ++thread) {
+    group.Spawn([first, &high_below, &low_above, from = wrong * thread / threads,
+                 to = wrong * (thread + 1) / threads]() {
+      auto skip = [](const auto& runs, long place) {
+        unsigned long run = 0;
+        while (place >= runs[run].second - runs[run].first) {
+          place -= runs[run].second - runs[run].first;
+          ++run;
+        }
+        return std::make_pair(run, runs[run].first + place);
+      };
+      if (from == to) {
+        return;
+      }
+      auto start = std::chrono::high_resolution_clock::now();
+      auto [high_run, high] = skip(high_below, from);
+      auto [low_run, low] = skip(low_above, from);
+      for (auto swaps = from; swaps < to; ++swaps) {
+        using std::swap;
+        swap(first[high++], first[low++]);
+        if (high == high_below[high_run].second && swaps + 1 < to) {
+          high = high_below[++high_run].first;
+        }
+        if (low == low_above[low_run].second && swaps + 1 < to) {
+          low = low_above[++low_run].first;
+        }
+      }
+      CountTime(first, false, start);
+      first->GetStats(); // Have to manually force a stats flush before this task moves on.
+    });
   }
-  futures.clear();
+  group.Wait();
+  return first + split;
 }
 
+// Partition around the middle item.  Returns the split point, and the pivot it split around (which
+// is empty if there were too few items to split).
 template <typename Ti>
-void UniSort(Ti first, Ti last, bool wait = true) noexcept {
-  SplitSortFutureBox<typename Ti::value_type> future_box;
-  auto& futures = future_box.futures;
+auto do_partition(Ti first, Ti last, int threads = 1) noexcept {
+  std::optional<typename std::iterator_traits<Ti>::value_type> pivot;
+  if (last - first < 2)
+    return std::make_pair(first, std::move(pivot));
+  pivot.emplace(*(first + ((last - first) / 2)));
+  auto mid = ParallelPartition(
+      first, last, [&pivot](const auto& em) { return em < *pivot; }, threads);
+  return std::make_pair(mid, std::move(pivot));
+}
+
+// Sort, and count the time as leaf sorting.
+template <typename Ti>
+void LeafSort(Ti first, Ti last) noexcept {
+  auto start = std::chrono::high_resolution_clock::now();
+  sort(first, last);
+  CountTime(first, true, start);
+}
 
+template <typename Ti>
+void UniSort(Ti first, Ti last, TaskGroup& group) noexcept {
   if ((last - first) < 1024) {
     // Fewer than 1k items: Below sanity limit - don't bother to thread.
-    sort(first, last);
+    LeafSort(first, last);
   } else {
-    futures.push_back(std::async(std::launch::async, [first, last]() {
-      sort(first, last);
-      first->GetStats(); // Have to manually force a stats flush before this thread goes away.
-    }));
-    if (wait)
-      WaitAll(first);
+    group.Spawn([first, last]() {
+      LeafSort(first, last);
+      first->GetStats(); // Have to manually force a stats flush before this task moves on.
+    });
   }
 }
 template <typename T>
 void UniSort(T& data) noexcept {
-  UniSort(data.begin(), data.end());
+  TaskGroup group;
+  UniSort(data.begin(), data.end(), group);
+  group.Wait();
 }
 
+// Each level of splitting uses all the threads under it, for its partition, and the two halves
+// are split at the same time (the upper one in a task of its own).
 template <typename Ti>
-void DualSort(Ti first, Ti last, bool wait = true) noexcept {
-  auto mid = do_partition(first, last);
-  UniSort(first, mid, false);
-  UniSort(mid, last, false);
-  if (wait)
-    WaitAll(first);
+void DualSort(Ti first, Ti last, TaskGroup& group) noexcept {
+  auto mid = do_partition(first, last, 2).first;
+  UniSort(first, mid, group);
+  UniSort(mid, last, group);
 }
 template <typename T>
 void DualSort(T& data) noexcept {
-  DualSort(data.begin(), data.end());
+  TaskGroup group;
+  DualSort(data.begin(), data.end(), group);
+  group.Wait();
 }
 
 template <typename Ti>
-void QuadSort(Ti first, Ti last, bool wait = true) noexcept {
-  auto mid = do_partition(first, last);
-  DualSort(first, mid, false);
-  DualSort(mid, last, false);
-  if (wait)
-    WaitAll(first);
+void QuadSort(Ti first, Ti last, TaskGroup& group) noexcept {
+  auto mid = do_partition(first, last, 4).first;
+  group.Spawn([mid, last, &group]() {
+    DualSort(mid, last, group);
+    mid->GetStats(); // Have to manually force a stats flush before this task moves on.
+  });
+  DualSort(first, mid, group);
 }
 template <typename T>
 void QuadSort(T& data) noexcept {
-  QuadSort(data.begin(), data.end());
+  TaskGroup group;
+  QuadSort(data.begin(), data.end(), group);
+  group.Wait();
 }
 
 template <typename Ti>
-void OctoSort(Ti first, Ti last, bool wait = true) noexcept {
-  auto mid = do_partition(first, last);
-  QuadSort(first, mid, false);
-  QuadSort(mid, last, false);
-  if (wait)
-    WaitAll(first);
+void OctoSort(Ti first, Ti last, TaskGroup& group) noexcept {
+  auto mid = do_partition(first, last, 8).first;
+  group.Spawn([mid, last, &group]() {
+    QuadSort(mid, last, group);
+    mid->GetStats(); // Have to manually force a stats flush before this task moves on.
+  });
+  QuadSort(first, mid, group);
 }
 template <typename T>
 void OctoSort(T& data) noexcept {
-  OctoSort(data.begin(), data.end());
+  TaskGroup group;
+  OctoSort(data.begin(), data.end(), group);
+  group.Wait();
+}
+
+// Keep splitting, spawning the lower part of each split as a new task, until the pieces are small
+// enough to just sort.  The pool balances these, instead of fixing the number of parts up front.
+template <typename Ti>
+void SplitSort(Ti first, Ti last, TaskGroup& group) noexcept {
+  while (last - first > 0x4000) {
+    auto split = do_partition(first, last);
+    auto mid = split.first;
+    if (mid == first) {
+      // Pivot was the smallest: split off everything equal to it instead, which is done already.
+      const auto& pivot = *split.second;
+      first = std::partition(first, last, [&pivot](const auto& em) { return !(pivot < em); });
+      continue;
+    }
+    group.Spawn([first, mid, &group]() {
+      SplitSort(first, mid, group);
+      first->GetStats(); // Have to manually force a stats flush before this task moves on.
+    });
+    first = mid;
+  }
+  LeafSort(first, last);
+}
+template <typename T>
+void SplitSort(T& data) noexcept {
+  TaskGroup group;
+  SplitSort(data.begin(), data.end(), group);
+  group.Wait();
 }
@@ -0,0 +1,342 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "data.hpp"
+#include "threadpool.hpp"
+
+// Sorts for strings, and other keys of any length, which are ordered byte by byte (shorter first,
+// when one is a prefix of the other).  The items only have to provide GetPrefix() and Length(),
+// as Data<std::string> does.
+
+// Buckets with fewer items than this are finished by multikey quicksort, not by more radix passes.
+constexpr unsigned long string_radix_min = 0x800;
+
+// Multikey quicksort (after Bentley and Sedgewick) of items that all have the same first depth
+// bytes.  It partitions on the next 8 bytes of each item at once, which are cached (from
+// GetPrefix()) alongside the items, so an item's string is only read again once its group is
+// equal in all 8 bytes, and goes on to the next 8.
+template <typename Ti>
+void CachedMultikeyQuickSort(
+    Ti begin, uint64_t* cache, unsigned long size, unsigned long depth) noexcept {
+  using std::swap;
+  while (size > 16) {
+    // Three-way partition, around the median of three medians of three of the prefixes (as the
+    // partition leaves the items above the pivot in an order that defeats a median of three)
+    auto median = [cache](unsigned long a, unsigned long b, unsigned long c) {
+      return std::max(
+          std::min(cache[a], cache[b]), std::min(std::max(cache[a], cache[b]), cache[c]));
+    };
+    const auto step = size / 8;
+    auto pivot = median(size / 2 - step, size / 2, size / 2 + step);
+    if (size > 128) {
+      auto low = median(0, step, 2 * step);
+      auto high = median(size - 1 - 2 * step, size - 1 - step, size - 1);
+      pivot = std::max(std::min(low, pivot), std::min(std::max(low, pivot), high));
+    }
+    unsigned long less = 0;
+    unsigned long place = 0;
+    unsigned long more = size;
+    while (place < more) {
+      if (cache[place] < pivot) {
+        swap(begin[less], begin[place]);
+        std::swap(cache[less++], cache[place++]);
+      } else if (pivot < cache[place]) {
+        swap(begin[place], begin[--more]);
+        std::swap(cache[place], cache[more]);
+      } else {
+        ++place;
+      }
+    }
+    CachedMultikeyQuickSort(begin, cache, less, depth);
+    CachedMultikeyQuickSort(begin + more, cache + more, size - more, depth);
+
+    // Of the equal ones, those that end within the 8 bytes differ only by trailing zero bytes, so
+    // they go first, by length (which only happens when the last byte is zero).  The rest go on.
+    auto first = begin + less;
+    auto rest = first;
+    if ((pivot & 0xFF) == 0) {
+      rest = std::partition(first, begin + more, [depth](const auto& item) {
+        return item.Length() <= depth + 8;
+      });
+      std::sort(first, rest);
+    }
+    depth += 8;
+    cache += rest - begin;
+    size = more - (rest - begin);
+    begin = rest;
+    for (unsigned long item = 0; item < size; ++item) {
+      cache[item] = begin[item].GetPrefix(depth);
+    }
+  }
+
+  // Insertion sort, by prefix, and only by the whole strings where the prefixes are equal
+  for (unsigned long place = 1; place < size; ++place) {
+    auto dest = place;
+    while (dest > 0 &&
+           (cache[place] < cache[dest - 1] ||
+            (cache[place] == cache[dest - 1] && begin[place] < begin[dest - 1]))) {
+      --dest;
+    }
+    if (dest < place) {
+      std::rotate(begin + dest, begin + place, begin + place + 1);
+      std::rotate(cache + dest, cache + place, cache + place + 1);
+    }
+  }
+}
+
+// The radix digit at depth of an item of the given length, from its cached 8 bytes from the last
+// multiple of 8 at or before depth: the byte plus one, or zero once past the end.
+inline uint16_t StringBin(uint64_t word, unsigned long length, unsigned long depth) noexcept {
+  return (depth < length) ? ((word >> (56 - 8 * (depth % 8))) & 0xFF) + 1 : 0;
+}
+
+// Fill the oracle with the digit at depth of each item, and count the items in each bin, with
+// each thread doing its own slice.  The cached prefixes are only read from the items again when
+// depth gets to the next 8 bytes, so the rest of the passes don't go back to the strings at all.
+template <typename Ti, typename A>
+void CountStringBins(
+    Ti begin,
+    unsigned long size,
+    unsigned long depth,
+    uint64_t* cache,
+    uint16_t* oracle,
+    int threads,
+    A& count) noexcept {
+  auto fill = [begin, depth, cache, oracle](unsigned long first, unsigned long last, A& cnt) {
+    for (auto item = first; item < last; ++item) {
+      if (depth % 8 == 0) {
+        cache[item] = begin[item].GetPrefix(depth);
+      }
+      ++cnt[oracle[item] = StringBin(cache[item], begin[item].Length(), depth)];
+    }
+  };
+  if (threads < 2) {
+    fill(0, size, count);
+    return;
+  }
+
+  const unsigned long step = (size + threads - 1) / threads;
+  std::vector<A> counts(threads);
+  TaskGroup group;
+  for (auto thread = 0; thread < threads; ++thread) {
+    auto first = std::min(size, step * thread);
+    auto last = std::min(size, step * (thread + 1));
+    group.Spawn([begin, fill, first, last, cnt = &counts[thread]]() {
+      fill(first, last, *cnt);
+      begin->GetStats(); // Must manually force a stats flush before this task moves on.
+    });
+  }
+  group.Wait();
+  for (auto& cnt : counts) {
+    for (unsigned long bin = 0; bin < cnt.size(); ++bin) {
+      count[bin] += cnt[bin];
+    }
+  }
+}
+
+// MSD radix sort of items that all have the same first depth bytes, one byte per pass, into 257
+// bins (the first for the items that end there, which are then all equal).  The digit of each
+// item is read once per pass, into the oracle, for both the count and the in-place permutation
+// (after Karkkainen and Rantala), from the next 8 bytes of each item, cached alongside it, which
+// are valid from the last multiple of 8 at or before depth.  That's how it's called, from depth 0,
+// and the cache and oracle have room for one entry per item.
+template <typename Ti>
+void StringRadixSort(
+    Ti begin,
+    Ti end,
+    unsigned long depth,
+    uint64_t* cache,
+    uint16_t* oracle,
+    int threads) noexcept {
+  using E = typename std::iterator_traits<Ti>::value_type;
+  constexpr unsigned long num_bins = 257;
+  const unsigned long size = end - begin;
+  for (; size >= string_radix_min; ++depth) {
+    std::array<unsigned long, num_bins> count = {};
+    CountStringBins(begin, size, depth, cache, oracle, (size >= 0x10000) ? threads : 1, count);
+    // If every item is in the same bin, this byte sorts nothing: skip straight to the next one
+    if (count[oracle[0]] == size) {
+      if (oracle[0] == 0) {
+        if (threads > 1 && size >= 0x10000) {
+          ThreadPool::Get().CountItems(size); // All ended, so no tasks will count them
+        }
+        return;
+      }
+      E::CountSkippedPass();
+      // If all the cached bytes are the same as well (and none end), skip the rest of them too
+      auto word = cache[0];
+      auto same = [word](uint64_t other) { return other == word; };
+      if ((word & 0xFF) != 0 && std::all_of(cache, cache + size, same)) {
+        for (; depth % 8 != 7; ++depth) {
+          E::CountSkippedPass();
+        }
+      }
+      continue;
+    }
+
+    // Each cycle starts from the first place not yet filled, and puts items in their bins (from
+    // the back of each) until it comes to one that belongs there.  That finishes the bin there.
+    std::array<unsigned long, num_bins> ends;
+    unsigned long offset = 0;
+    for (unsigned long bin = 0; bin < num_bins; ++bin) {
+      ends[bin] = offset += count[bin];
+    }
+    for (unsigned long place = 0; place < size;) {
+      auto bin = oracle[place];
+      auto word = cache[place];
+      auto temp = std::move(begin[place]);
+      for (auto dest = --ends[bin]; dest > place; dest = --ends[bin]) {
+        using std::swap;
+        swap(temp, begin[dest]);
+        std::swap(bin, oracle[dest]);
+        std::swap(word, cache[dest]);
+      }
+      begin[place] = std::move(temp);
+      cache[place] = word;
+      place += count[bin];
+    }
+
+    if (threads < 2 || size < 0x10000) {
+      offset = count[0];
+      for (unsigned long bin = 1; bin < num_bins; ++bin) {
+        auto next_offset = offset + count[bin];
+        if (count[bin] > 1) {
+          StringRadixSort(
+              begin + offset, begin + next_offset, depth + 1, cache + offset, oracle + offset, 1);
+        }
+        offset = next_offset;
+      }
+      return;
+    }
+
+    // Split the bins into runs of about an equal share of the items for each thread, as in
+    // CountingBinSort, with any bin bigger than a share split up over as many threads as shares.
+    ThreadPool::Get().CountItems(count[0]); // The ended strings, which no task will count
+    TaskGroup group;
+    auto spawn = [&group, begin, depth, cache, oracle, &count](
+                     unsigned long first, unsigned long last, unsigned long offset, int sub) {
+      group.Spawn([begin, depth, cache, oracle, cnt = count, first, last, offset, sub]() {
+        auto from = offset;
+        unsigned long own = 0; // Items not split up over more tasks, which count their own
+        for (auto bin = first; bin < last; ++bin) {
+          if (cnt[bin] > 1) {
+            StringRadixSort(
+                begin + from,
+                begin + from + cnt[bin],
+                depth + 1,
+                cache + from,
+                oracle + from,
+                sub);
+          }
+          if (sub < 2 || cnt[bin] < 0x10000) {
+            own += cnt[bin];
+          }
+          from += cnt[bin];
+        }
+        ThreadPool::Get().CountItems(own);
+        begin->GetStats(); // Must manually force a stats flush before this task moves on.
+      });
+    };
+    const unsigned long share = std::max(1UL, size / threads);
+    unsigned long first = 1;
+    offset = count[0];
+    unsigned long next_offset = offset;
+    for (unsigned long bin = 1; bin < num_bins; ++bin) {
+      if (count[bin] > share) {
+        if (first < bin) {
+          spawn(first, bin, offset, 1);
+        }
+        spawn(bin, bin + 1, next_offset, std::min<unsigned long>(threads, count[bin] / share));
+        first = bin + 1;
+        offset = next_offset += count[bin];
+        continue;
+      }
+      next_offset += count[bin];
+      if (next_offset - offset >= share || bin + 1 == num_bins) {
+        spawn(first, bin + 1, offset, 1);
+        first = bin + 1;
+        offset = next_offset;
+      }
+    }
+    group.Wait();
+    return;
+  }
+
+  for (unsigned long item = 0; item < size; ++item) {
+    cache[item] = begin[item].GetPrefix(depth);
+  }
+  CachedMultikeyQuickSort(begin, cache, size, depth);
+}
+
+// Not Stable, In-Place (but for 10 bytes per item of cache and oracle), Optionally Threaded
+template <typename T>
+void StringRadixSort(T& data, int threads = 1) noexcept {
+  if (AlreadyOrdered(data.begin(), data.end())) {
+    return;
+  }
+  std::vector<uint64_t> cache(data.size());
+  std::vector<uint16_t> oracle(data.size());
+  StringRadixSort(data.begin(), data.end(), 0, cache.data(), oracle.data(), threads);
+}
+
+// Not Stable, In-Place (but for 8 bytes per item of cache), Not Threaded
+template <typename T>
+void MultikeyQuickSort(T& data) noexcept {
+  std::vector<uint64_t> cache(data.size());
+  for (unsigned long item = 0; item < data.size(); ++item) {
+    cache[item] = data[item].GetPrefix(0);
+  }
+  CachedMultikeyQuickSort(data.begin(), cache.data(), data.size(), 0);
+}
+
+// Not Stable, In-Place, 2 Threads
+template <typename T>
+void DualStringRadixSort(T& data) noexcept {
+  StringRadixSort(data, 2);
+}
+
+// Not Stable, In-Place, 4 Threads
+template <typename T>
+void QuadStringRadixSort(T& data) noexcept {
+  StringRadixSort(data, 4);
+}
+
+// Not Stable, In-Place, 8 Threads
+template <typename T>
+void OctoStringRadixSort(T& data) noexcept {
+  StringRadixSort(data, 8);
+}
+
+// Not Stable, In-Place, One Thread Per Core
+template <typename T>
+void AllCoresStringRadixSort(T& data) noexcept {
+  StringRadixSort(data, std::max(1U, std::thread::hardware_concurrency()));
+}
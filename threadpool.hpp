@@ -0,0 +1,241 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// This ThreadPool is a persistent, work-stealing scheduler shared by all the parallel sorts.  It
+// is started once, with one worker per core.  Each worker has its own deque: tasks spawned from a
+// worker go on the back of its own deque, and it takes work from the back of its own, but idle
+// workers steal from the front of the others, so recursively spawned subproblems spread out.
+class ThreadPool {
+ public:
+  static ThreadPool& Get() noexcept {
+    static ThreadPool pool(std::max(1U, std::thread::hardware_concurrency()));
+    return pool;
+  }
+
+  int Size() const noexcept {
+    return workers.size();
+  }
+
+  void Submit(std::function<void()> task) noexcept {
+    auto queue = (index >= 0) ? index : next_queue++ % queues.size();
+    {
+      std::lock_guard<std::mutex> lock(queues[queue]->lock);
+      queues[queue]->tasks.push_back(std::move(task));
+    }
+    ++pending;
+    { std::lock_guard<std::mutex> lock(sleep_lock); }
+    wake.notify_one();
+  }
+
+  // Run one queued task on the calling thread, if there are any.  Returns false if none were found.
+  bool RunOne() noexcept {
+    std::function<void()> task;
+    auto start = (index >= 0) ? index : 0;
+    for (unsigned long victim = 0; victim < queues.size() && !task; ++victim) {
+      auto& queue = *queues[(start + victim) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.lock);
+      if (!queue.tasks.empty()) {
+        if (victim == 0 && index >= 0) {
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
+        } else {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+        }
+      }
+    }
+    if (!task) {
+      return false;
+    }
+    --pending;
+    // Tasks run while this one waits are timed on their own, so they're taken out of its time
+    const unsigned long outer_nested = nested_ns;
+    nested_ns = 0;
+    auto began = std::chrono::steady_clock::now();
+    task();
+    const unsigned long took = (std::chrono::steady_clock::now() - began).count();
+    loads[Slot()].busy += took - std::min(took, nested_ns);
+    nested_ns = outer_nested + took;
+    return true;
+  }
+
+  // How much work each worker did, and (last) threads outside the pool did, running tasks: the
+  // items the tasks said they handled, and the ns spent running them (not counting other tasks
+  // run inside them).  For seeing the balance.  Only the tasks that don't hand their items on to
+  // more tasks should count them, so the items add up to the size of the data.
+  struct Load {
+    unsigned long items;
+    unsigned long busy;
+  };
+  void CountItems(unsigned long items) noexcept {
+    loads[Slot()].items += items;
+  }
+  std::vector<Load> GetLoads() const noexcept {
+    std::vector<Load> out;
+    for (auto& load : loads) {
+      out.push_back({load.items, load.busy});
+    }
+    return out;
+  }
+  void ResetLoads() noexcept {
+    for (auto& load : loads) {
+      load.items = 0;
+      load.busy = 0;
+    }
+  }
+
+  // The kernel's ids of the worker threads (for per-thread tools like perf counters), or -1 where
+  // there is none.  Waits for any workers that haven't started yet.
+  std::vector<long> ThreadIds() const noexcept {
+    std::vector<long> out;
+    for (auto& tid : tids) {
+      while (tid == 0) {
+        std::this_thread::yield();
+      }
+      out.push_back(tid);
+    }
+    return out;
+  }
+
+  ~ThreadPool() noexcept {
+    {
+      std::lock_guard<std::mutex> lock(sleep_lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+ private:
+  int Slot() const noexcept {
+    return (index >= 0) ? index : loads.size() - 1;
+  }
+
+  explicit ThreadPool(int threads) noexcept : loads(threads + 1), tids(threads) {
+    for (auto thread = 0; thread < threads; ++thread) {
+      queues.emplace_back(std::make_unique<Queue>());
+    }
+    for (auto thread = 0; thread < threads; ++thread) {
+      workers.emplace_back([this, thread]() { Work(thread); });
+    }
+  }
+
+  void Work(int thread) noexcept {
+    index = thread;
+#ifdef __linux__
+    tids[thread] = syscall(SYS_gettid);
+#else
+    tids[thread] = -1;
+#endif
+    for (;;) {
+      if (RunOne()) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_lock);
+      wake.wait(lock, [this]() { return stopping || pending > 0; });
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  struct Queue {
+    std::mutex lock;
+    std::deque<std::function<void()>> tasks;
+  };
+  struct AtomicLoad {
+    std::atomic<unsigned long> items = 0;
+    std::atomic<unsigned long> busy = 0;
+  };
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<AtomicLoad> loads;
+  std::vector<std::atomic<long>> tids;
+  std::vector<std::thread> workers;
+  std::atomic<unsigned long> next_queue = 0;
+  std::atomic<long> pending = 0;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+  bool stopping = false;
+  static inline thread_local int index = -1;
+  static inline thread_local unsigned long nested_ns = 0; // Run by tasks inside the current one
+};
+
+// A TaskGroup tracks a set of tasks spawned into the ThreadPool, so they can all be waited for.
+// Tasks may spawn more tasks into the same group.  A thread waiting on a group runs queued tasks
+// itself while it waits, so nested waits never leave the pool without a runnable thread.
+class TaskGroup {
+ public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup&) = delete;
+  void operator=(const TaskGroup&) = delete;
+  ~TaskGroup() noexcept {
+    Wait();
+  }
+
+  template <typename F>
+  void Spawn(F&& func) noexcept {
+    ++active;
+    ThreadPool::Get().Submit([this, func = std::forward<F>(func)]() mutable {
+      func();
+      std::lock_guard<std::mutex> lock(done_lock);
+      if (--active == 0) {
+        done.notify_all();
+      }
+    });
+  }
+
+  void Wait() noexcept {
+    auto& pool = ThreadPool::Get();
+    while (active > 0) {
+      if (!pool.RunOne()) {
+        std::unique_lock<std::mutex> lock(done_lock);
+        done.wait_for(lock, std::chrono::microseconds(100), [this]() { return active == 0; });
+      }
+    }
+    // The last task to finish may still hold the lock, so don't return until it lets go.
+    std::lock_guard<std::mutex> lock(done_lock);
+  }
+
+ private:
+  std::atomic<unsigned long> active = 0;
+  std::mutex done_lock;
+  std::condition_variable done;
+};
@@ -0,0 +1,114 @@
+// *************************************************************************
+//  This file is part of the Sorting test project by Steaphan Greene
+//
+//  Copyright 2018 Steaphan Greene <steaphan@gmail.com>
+//
+//  Sorting is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Sorting is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Sorting (see the file named "LICENSE");
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+// *************************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "threadpool.hpp"
+
+// Checks of the output of a sort, spread over every core, since one thread checking a large
+// output can take longer than a parallel sort took to make it.
+
+// The number of threads the checks use: one per core.
+inline int VerifyThreads() noexcept {
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// The number of items in data, which lists without a size() have to count.
+template <typename C>
+unsigned long ItemsIn(C& data) noexcept {
+  if constexpr (std::random_access_iterator<typename C::const_iterator>) {
+    return data.size();
+  } else {
+    unsigned long size = 0;
+    for (auto it = data.begin(); it != data.end(); ++it) {
+      ++size;
+    }
+    return size;
+  }
+}
+
+// Whether the data is in order, with each thread checking its own slice, up to and including the
+// first item of the next one.  Containers without random access are checked by one thread.
+template <typename C>
+bool ParallelIsSorted(C& data, int threads = VerifyThreads()) noexcept {
+  using std::is_sorted;
+  if constexpr (!std::random_access_iterator<typename C::const_iterator>) {
+    return is_sorted(data.begin(), data.end());
+  } else {
+    const unsigned long size = data.size();
+    const unsigned long step = (size + threads - 1) / std::max(1, threads);
+    std::vector<char> sorted(threads, true);
+    TaskGroup group;
+    for (auto thread = 0; thread < threads && step * thread < size; ++thread) {
+      auto first = data.cbegin() + step * thread;
+      auto last = data.cbegin() + std::min(size, step * (thread + 1) + 1);
+      group.Spawn([first, last, in_order = &sorted[thread]]() {
+        *in_order = is_sorted(first, last);
+        first->GetStats(); // Must manually force a stats flush before this task moves on.
+      });
+    }
+    group.Wait();
+    return std::all_of(sorted.begin(), sorted.end(), [](char in_order) { return in_order; });
+  }
+}
+
+// Hash of the items in data that doesn't depend on their order: the sum of the hash of each one,
+// so a permutation of the same items has the same hash, but output with an item dropped, or
+// duplicated, or changed, almost certainly doesn't.
+template <typename C>
+uint64_t MultisetHash(C& data, int threads = VerifyThreads()) noexcept {
+  if constexpr (!std::random_access_iterator<typename C::const_iterator>) {
+    uint64_t hash = 0;
+    for (auto it = data.begin(); it != data.end(); ++it) {
+      hash += it->Hash();
+    }
+    return hash;
+  } else {
+    const unsigned long size = data.size();
+    const unsigned long step = (size + threads - 1) / std::max(1, threads);
+    std::vector<uint64_t> hashes(threads);
+    TaskGroup group;
+    for (auto thread = 0; thread < threads && step * thread < size; ++thread) {
+      auto first = data.cbegin() + step * thread;
+      auto last = data.cbegin() + std::min(size, step * (thread + 1));
+      group.Spawn([first, last, hash = &hashes[thread]]() {
+        uint64_t sum = 0;
+        for (auto it = first; it != last; ++it) {
+          sum += it->Hash();
+        }
+        *hash = sum;
+        first->GetStats(); // Must manually force a stats flush before this task moves on.
+      });
+    }
+    group.Wait();
+    uint64_t hash = 0;
+    for (auto part : hashes) {
+      hash += part;
+    }
+    return hash;
+  }
+}